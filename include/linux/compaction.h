@@ -23,9 +23,15 @@ extern int fragmentation_index(struct zone *zone, unsigned int order);
 extern unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			int order, gfp_t gfp_mask, nodemask_t *mask,
 			bool sync, bool *contended);
-extern int compact_pgdat(pg_data_t *pgdat, int order);
 extern unsigned long compaction_suitable(struct zone *zone, int order);
 
+extern int sysctl_kcompactd_free_pct;
+extern int sysctl_kcompactd_interval_ms;
+extern int sysctl_kcompactd_cpu_pct;
+extern void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx);
+extern int kcompactd_run(int nid);
+extern void kcompactd_stop(int nid);
+
 /* Do not skip compaction more than 64 times */
 #define COMPACT_MAX_DEFER_SHIFT 6
 
@@ -69,9 +75,18 @@ static inline unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	return COMPACT_CONTINUE;
 }
 
-static inline int compact_pgdat(pg_data_t *pgdat, int order)
+static inline void wakeup_kcompactd(pg_data_t *pgdat, int order,
+				    int classzone_idx)
+{
+}
+
+static inline int kcompactd_run(int nid)
+{
+	return 0;
+}
+
+static inline void kcompactd_stop(int nid)
 {
-	return COMPACT_CONTINUE;
 }
 
 static inline unsigned long compaction_suitable(struct zone *zone, int order)
@@ -63,7 +63,9 @@ extern int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 					gfp_t gfp_mask);
 
 struct lruvec *mem_cgroup_zone_lruvec(struct zone *, struct mem_cgroup *);
-struct lruvec *mem_cgroup_page_lruvec(struct page *, struct zone *);
+struct lruvec *mem_cgroup_relock_page_lruvec(struct page *, struct lruvec *);
+bool mem_cgroup_page_in_lruvec(struct page *, struct lruvec *);
+struct mem_cgroup *lruvec_memcg(struct lruvec *);
 
 /* For coalescing uncharge for reducing memcg' overhead*/
 extern void mem_cgroup_uncharge_start(void);
@@ -242,10 +244,9 @@ static inline struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
 	return &zone->lruvec;
 }
 
-static inline struct lruvec *mem_cgroup_page_lruvec(struct page *page,
-						    struct zone *zone)
+static inline struct mem_cgroup *lruvec_memcg(struct lruvec *lruvec)
 {
-	return &zone->lruvec;
+	return NULL;
 }
 
 static inline struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
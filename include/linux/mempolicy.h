@@ -20,6 +20,7 @@ enum {
 	MPOL_PREFERRED,
 	MPOL_BIND,
 	MPOL_INTERLEAVE,
+	MPOL_COLOR,	/* local node, pages of the palloc colors in the mask */
 	MPOL_MAX,	/* always last member of enum */
 };
 
@@ -102,6 +103,9 @@ struct mempolicy {
 	union {
 		short 		 preferred_node; /* preferred */
 		nodemask_t	 nodes;		/* interleave/bind */
+#ifdef CONFIG_CGROUP_PALLOC
+		COLOR_BITMAP(colors);		/* color */
+#endif
 		/* undefined for default */
 	} v;
 	union {
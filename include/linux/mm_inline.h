@@ -21,12 +21,133 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+static inline bool lru_gen_enabled(void)
+{
+	return ACCESS_ONCE(sysctl_lru_gen_enabled);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Returns the generation of a page on a multi-gen LRU, or -1 */
+static inline int page_lru_gen(struct page *page)
+{
+	return ((page->flags & __PG_LRU_GEN) >> PG_lru_gen) - 1;
+}
+
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+	unsigned long old, new;
+
+	/* other flags may be changed atomically under us */
+	do {
+		old = ACCESS_ONCE(page->flags);
+		new = (old & ~__PG_LRU_GEN) |
+		      ((unsigned long)(gen + 1) << PG_lru_gen);
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+/* Move a page on a multi-gen LRU to generation @seq, at the tail if @tail */
+static inline void lru_gen_move_page(struct page *page, struct lruvec *lruvec,
+				     unsigned long seq, bool tail)
+{
+	int gen = lru_gen_from_seq(seq);
+	struct list_head *head;
+
+	head = &lruvec->lrugen.lists[gen][page_is_file_cache(page)];
+	set_page_lru_gen(page, gen);
+	if (tail)
+		list_move_tail(&page->lru, head);
+	else
+		list_move(&page->lru, head);
+}
+
+/*
+ * Pages added while the multi-gen LRU is enabled go into the youngest
+ * generation if active and into the oldest one otherwise.  Unevictable
+ * pages stay on their list.
+ */
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int file = is_file_lru(lru);
+	unsigned long seq;
+	int gen;
+
+	VM_BUG_ON(page_lru_gen(page) != -1);
+	if (!lru_gen_enabled() || lru == LRU_UNEVICTABLE)
+		return false;
+
+	seq = is_active_lru(lru) ? lrugen->max_seq : lrugen->min_seq[file];
+	gen = lru_gen_from_seq(seq);
+	set_page_lru_gen(page, gen);
+	list_add(&page->lru, &lrugen->lists[gen][file]);
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct page *page)
+{
+	if (page_lru_gen(page) < 0)
+		return false;
+
+	list_del(&page->lru);
+	set_page_lru_gen(page, -1);
+	return true;
+}
+
+static inline bool lru_gen_move_tail(struct page *page, struct lruvec *lruvec)
+{
+	if (page_lru_gen(page) < 0)
+		return false;
+
+	lru_gen_move_page(page, lruvec,
+			  lruvec->lrugen.min_seq[page_is_file_cache(page)],
+			  true);
+	return true;
+}
+#else
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline int page_lru_gen(struct page *page)
+{
+	return -1;
+}
+
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+}
+
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    enum lru_list lru)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct page *page)
+{
+	return false;
+}
+
+static inline bool lru_gen_move_tail(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-	list_add(&page->lru, &lruvec->lists[lru]);
+	if (!lru_gen_add_page(page, lruvec, lru))
+		list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
 }
 
@@ -35,10 +156,99 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 {
 	int nr_pages = hpage_nr_pages(page);
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
-	list_del(&page->lru);
+	if (!lru_gen_del_page(page))
+		list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
 }
 
+/*
+ * Move a page to the end of its lru list that reclaim looks at first,
+ * the oldest generation on a multi-gen LRU.
+ */
+static __always_inline void move_page_to_lru_tail(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	if (!lru_gen_move_tail(page, lruvec))
+		list_move_tail(&page->lru, &lruvec->lists[lru]);
+}
+
+/*
+ * The lru lists of a page are protected by the lru lock of its lruvec.
+ * The lruvec of a page is only stable while that lock is held, so find
+ * and lock it in one go.  The relock variants take the lruvec whose lock
+ * is already held, and keep it if the page belongs to the same lock, which
+ * lets callers batch pages from the same memcg and zone under one lock.
+ */
+static __always_inline struct lruvec *__relock_page_lruvec(struct page *page,
+						struct lruvec *locked)
+{
+#ifdef CONFIG_MEMCG
+	return mem_cgroup_relock_page_lruvec(page, locked);
+#else
+	struct lruvec *lruvec = &page_zone(page)->lruvec;
+
+	if (lruvec != locked) {
+		if (locked)
+			spin_unlock(locked->lru_lock);
+		spin_lock(lruvec->lru_lock);
+	}
+	return lruvec;
+#endif
+}
+
+/*
+ * Check that @page still belongs to @lruvec, whose lru lock is held, for
+ * callers that had to take another lock after it.
+ */
+static inline bool page_in_lruvec(struct page *page, struct lruvec *lruvec)
+{
+#ifdef CONFIG_MEMCG
+	return mem_cgroup_page_in_lruvec(page, lruvec);
+#else
+	return lruvec == &page_zone(page)->lruvec;
+#endif
+}
+
+static inline struct lruvec *lock_page_lruvec_irq(struct page *page)
+{
+	local_irq_disable();
+	return __relock_page_lruvec(page, NULL);
+}
+
+static inline struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+						      unsigned long *flags)
+{
+	local_irq_save(*flags);
+	return __relock_page_lruvec(page, NULL);
+}
+
+static inline struct lruvec *relock_page_lruvec_irq(struct page *page,
+						    struct lruvec *locked)
+{
+	if (!locked)
+		local_irq_disable();
+	return __relock_page_lruvec(page, locked);
+}
+
+static inline struct lruvec *relock_page_lruvec_irqsave(struct page *page,
+					struct lruvec *locked, unsigned long *flags)
+{
+	if (!locked)
+		local_irq_save(*flags);
+	return __relock_page_lruvec(page, locked);
+}
+
+static inline void unlock_lruvec_irq(struct lruvec *lruvec)
+{
+	spin_unlock_irq(lruvec->lru_lock);
+}
+
+static inline void unlock_lruvec_irqrestore(struct lruvec *lruvec,
+					    unsigned long flags)
+{
+	spin_unlock_irqrestore(lruvec->lru_lock, flags);
+}
+
 /**
  * page_lru_base_type - which LRU list type should a page be on?
  * @page: the page to test
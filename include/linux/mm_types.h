@@ -115,7 +115,7 @@ struct page {
 	/* Third double word block */
 	union {
 		struct list_head lru;	/* Pageout list, eg. active_list
-					 * protected by zone->lru_lock !
+					 * protected by lruvec->lru_lock !
 					 */
 		struct {		/* slub per cpu partial pages */
 			struct page *next;	/* Next partial slab */
@@ -405,6 +405,10 @@ struct mm_struct {
 	struct cpumask cpumask_allocation;
 #endif
 	struct uprobes_state uprobes_state;
+#ifdef CONFIG_LRU_GEN
+	/* on lru_gen_mm_list, walked to age the multi-gen LRU */
+	struct list_head lru_gen_mm_node;
+#endif
 };
 
 static inline void mm_init_cpumask(struct mm_struct *mm)
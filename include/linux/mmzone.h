@@ -91,12 +91,21 @@ static inline int get_pageblock_migratetype(struct page *page)
 struct free_area {
 	struct list_head	free_list[MIGRATE_TYPES];
 	unsigned long		nr_free;
+#ifdef CONFIG_CGROUP_PALLOC
+	/*
+	 * First free block of each key on free_list[migratetype], the key
+	 * being the color of the block's first page with the color bits
+	 * that vary inside a block masked. The blocks of a key follow each
+	 * other on the list.
+	 */
+	struct page		*color_first[MIGRATE_PCPTYPES][MAX_PALLOC_BINS];
+#endif
 };
 
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
+ * zone->lock and zone->lru_locks are two of the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -206,14 +215,62 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-generation LRU sorts the evictable pages of a lruvec into
+ * generations instead of the active and inactive lists.  Generations are
+ * numbered by an ever increasing sequence: max_seq is the youngest and
+ * min_seq[] the oldest one still holding anon ([0]) or file ([1]) pages.
+ * There are between MIN_NR_GENS and MAX_NR_GENS of them at any time, the
+ * lists of sequence seq being lists[seq % MAX_NR_GENS][].
+ *
+ * Pages are still accounted to the lru list page_lru() gives, so that the
+ * zone and memcg statistics do not depend on the mode reclaim runs in.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+struct lru_gen {
+	unsigned long		max_seq;
+	unsigned long		min_seq[2];
+	struct list_head	lists[MAX_NR_GENS][2];
+};
+
+extern int sysctl_lru_gen_enabled;
+#endif
+
 struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
+	spinlock_t *lru_lock;	/* one of zone->lru_locks */
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
 };
 
+/*
+ * The LRU lists of a zone are protected by a set of striped locks rather
+ * than a single zone-wide one, so that reclaim and LRU additions in
+ * different memory cgroups do not contend.  A memcg's lruvec in a zone
+ * always uses the stripe selected by hashing the memcg pointer, see
+ * mem_cgroup_lru_lock().  The locks are owned by the zone, not by the
+ * lruvec, because pc->mem_cgroup of an uncharged page may point to a
+ * memcg that is already gone while the page is still being freed.
+ */
+#ifdef CONFIG_MEMCG
+#define LRU_LOCK_BITS		6
+#else
+#define LRU_LOCK_BITS		0
+#endif
+#define NR_LRU_LOCKS		(1 << LRU_LOCK_BITS)
+
+struct lru_lock {
+	spinlock_t		lock;
+} ____cacheline_aligned_in_smp;
+
 /* Mask used at gathering information at once (see memcontrol.c) */
 #define LRU_ALL_FILE (BIT(LRU_INACTIVE_FILE) | BIT(LRU_ACTIVE_FILE))
 #define LRU_ALL_ANON (BIT(LRU_INACTIVE_ANON) | BIT(LRU_ACTIVE_ANON))
@@ -245,8 +302,29 @@ struct per_cpu_pages {
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
+	/* self-tuning of high and batch, see pcp_autotune() */
+	int base_high;		/* high and batch as set up for the zone, */
+	int base_batch;		/* the least they are tuned down to */
+	unsigned int nr_alloc;	/* pages allocated and freed since the */
+	unsigned int nr_free;	/* last tuning */
+	unsigned int alloc_rate; /* the same per interval, at the last */
+	unsigned int free_rate;	/* tuning */
+	unsigned long tune_stamp; /* jiffies at the last tuning */
+	unsigned long nr_refill; /* batches taken from the buddy lists */
+	unsigned long nr_drain;	/* batches given back to them */
+
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
+#ifdef CONFIG_CGROUP_PALLOC
+	/*
+	 * Order-0 pages sorted by migrate type and color, used instead of
+	 * lists[] when palloc is enabled. color_count pages are included
+	 * in count.
+	 */
+	int color_count;
+	COLOR_BITMAP(color_bitmap[MIGRATE_PCPTYPES]);
+	struct list_head color_lists[MIGRATE_PCPTYPES][MAX_PALLOC_BINS];
+#endif
 };
 
 struct per_cpu_pageset {
@@ -398,7 +476,12 @@ struct zone {
 	 * Color page cache. for movable type free pages of order-0
 	 */
 	struct list_head        color_list[MAX_PALLOC_BINS];
+	unsigned int		color_nr[MAX_PALLOC_BINS];
 	COLOR_BITMAP(color_bitmap);
+	/* colors allocated from since the last rebalancer pass */
+	COLOR_BITMAP(color_used);
+	/* configuration free_area[].color_first is keyed for, NULL if none */
+	struct palloc_colors	*color_cfg;
 #endif
 
 #ifndef CONFIG_SPARSEMEM
@@ -418,12 +501,14 @@ struct zone {
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
 	int			compact_order_failed;
+	/* kcompactd leaves the zone alone until then after a fruitless pass */
+	unsigned long		kcompactd_defer_until;
 #endif
 
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;
+	struct lru_lock		lru_locks[NR_LRU_LOCKS];
 	struct lruvec		lruvec;
 
 	unsigned long		pages_scanned;	   /* since last reclaim */
@@ -680,6 +765,21 @@ struct node_active_region {
 extern struct page *mem_map;
 #endif
 
+/* upper limit of vm.kswapd_threads */
+#define MAX_KSWAPD_THREADS	16
+
+struct pglist_data;
+
+/*
+ * The wakeup of one kswapd thread: every thread gets a copy of each
+ * request, so that the first one to wake does not consume it for all.
+ */
+struct kswapd_request {
+	struct pglist_data *pgdat;
+	int order;
+	enum zone_type classzone_idx;
+};
+
 /*
  * The pg_data_t structure is used in machines with CONFIG_DISCONTIGMEM
  * (mostly NUMA machines?) to denote a higher-level memory zone than the
@@ -722,9 +822,20 @@ typedef struct pglist_data {
 	int node_id;
 	wait_queue_head_t kswapd_wait;
 	wait_queue_head_t pfmemalloc_wait;
-	struct task_struct *kswapd;	/* Protected by lock_memory_hotplug() */
-	int kswapd_max_order;
-	enum zone_type classzone_idx;
+	/* the first kswapd_threads are running, see kswapd_run() */
+	struct task_struct *kswapd[MAX_KSWAPD_THREADS];
+					/* Protected by lock_memory_hotplug() */
+	struct kswapd_request kswapd_req[MAX_KSWAPD_THREADS];
+#ifdef CONFIG_CGROUP_PALLOC
+	wait_queue_head_t kcolord_wait;
+	struct task_struct *kcolord;	/* Protected by lock_memory_hotplug() */
+#endif
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;	/* Protected by lock_memory_hotplug() */
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
@@ -871,6 +982,7 @@ int min_free_kbytes_sysctl_handler(struct ctl_table *, int,
 extern int sysctl_lowmem_reserve_ratio[MAX_NR_ZONES-1];
 int lowmem_reserve_ratio_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
+extern int percpu_pagelist_autotune;
 int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *, int,
 					void __user *, size_t *, loff_t *);
 int sysctl_min_unmapped_ratio_sysctl_handler(struct ctl_table *, int,
@@ -71,6 +71,10 @@
  * SPARSEMEM section (for variants of SPARSEMEM that require section ids like
  * SPARSEMEM_EXTREME with !SPARSEMEM_VMEMMAP).
  */
+
+/* bits holding the generation + 1 of a page on a multi-gen LRU, 0 if none */
+#define LRU_GEN_WIDTH		3
+
 enum pageflags {
 	PG_locked,		/* Page is locked. Don't touch. */
 	PG_error,
@@ -108,6 +112,10 @@ enum pageflags {
 #endif
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	PG_compound_lock,
+#endif
+#ifdef CONFIG_LRU_GEN
+	PG_lru_gen,		/* LRU_GEN_WIDTH bits, see page_lru_gen() */
+	PG_lru_gen_last = PG_lru_gen + LRU_GEN_WIDTH - 1,
 #endif
 	__NR_PAGEFLAGS,
 
@@ -494,6 +502,12 @@ static inline void ClearPageSlabPfmemalloc(struct page *page)
 #define __PG_COMPOUND_LOCK		0
 #endif
 
+#ifdef CONFIG_LRU_GEN
+#define __PG_LRU_GEN		(((1UL << LRU_GEN_WIDTH) - 1) << PG_lru_gen)
+#else
+#define __PG_LRU_GEN		0
+#endif
+
 /*
  * Flags checked when a page is freed.  Pages being freed should not have
  * these flags set.  It they are, there is a problem.
@@ -504,7 +518,7 @@ static inline void ClearPageSlabPfmemalloc(struct page *page)
 	 1 << PG_writeback | 1 << PG_reserved | \
 	 1 << PG_slab	 | 1 << PG_swapcache | 1 << PG_active | \
 	 1 << PG_unevictable | __PG_MLOCKED | __PG_HWPOISON | \
-	 __PG_COMPOUND_LOCK)
+	 __PG_COMPOUND_LOCK | __PG_LRU_GEN)
 
 /*
  * Flags checked when a page is prepped for return by the page allocator.
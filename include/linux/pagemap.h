@@ -209,22 +209,54 @@ static inline struct page *__page_cache_alloc(gfp_t gfp)
 }
 #endif
 
+#ifdef CONFIG_CGROUP_PALLOC
+/* allocate a page for the page cache of x in the bins of its owner */
+extern struct page *__page_cache_alloc_mapping(struct address_space *x,
+					       gfp_t gfp);
+/* allocate up to nr of them onto list at once, return how many */
+extern unsigned long __page_cache_alloc_bulk(struct address_space *x,
+					     gfp_t gfp, unsigned long nr,
+					     struct list_head *list);
+#else
+static inline struct page *__page_cache_alloc_mapping(struct address_space *x,
+						      gfp_t gfp)
+{
+	return __page_cache_alloc(gfp);
+}
+
+static inline unsigned long __page_cache_alloc_bulk(struct address_space *x,
+						    gfp_t gfp, unsigned long nr,
+						    struct list_head *list)
+{
+	return 0;
+}
+#endif
+
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
-	return __page_cache_alloc(mapping_gfp_mask(x));
+	return __page_cache_alloc_mapping(x, mapping_gfp_mask(x));
 }
 
 static inline struct page *page_cache_alloc_cold(struct address_space *x)
 {
-	return __page_cache_alloc(mapping_gfp_mask(x)|__GFP_COLD);
+	return __page_cache_alloc_mapping(x, mapping_gfp_mask(x)|__GFP_COLD);
 }
 
 static inline struct page *page_cache_alloc_readahead(struct address_space *x)
 {
-	return __page_cache_alloc(mapping_gfp_mask(x) |
+	return __page_cache_alloc_mapping(x, mapping_gfp_mask(x) |
 				  __GFP_COLD | __GFP_NORETRY | __GFP_NOWARN);
 }
 
+static inline unsigned long page_cache_alloc_readahead_bulk(
+		struct address_space *x, unsigned long nr,
+		struct list_head *list)
+{
+	return __page_cache_alloc_bulk(x, mapping_gfp_mask(x) |
+				__GFP_COLD | __GFP_NORETRY | __GFP_NOWARN,
+				nr, list);
+}
+
 typedef int filler_t(void *, struct page *);
 
 extern struct page * find_get_page(struct address_space *mapping,
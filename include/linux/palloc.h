@@ -14,9 +14,75 @@
 
 #ifdef CONFIG_CGROUP_PALLOC
 
+enum palloc_stat_item {
+	PALLOC_HIT,		/* colored page from a color cache */
+	PALLOC_MISS,		/* colored page after rebuilding the cache */
+	PALLOC_FALLBACK,	/* page outside of the group's bins */
+	PALLOC_FAIL,		/* no page in the zone */
+	PALLOC_ITERS,		/* free blocks visited */
+	PALLOC_NEIGHBOR,	/* page of a color next to the group's bins */
+	PALLOC_STRICT_FAIL,	/* strict policy refused a fallback page */
+	PALLOC_INTERLEAVE,	/* colored page picked round-robin */
+	PALLOC_RESERVE,		/* page from the reserve pool */
+	NR_PALLOC_STAT_ITEMS
+};
+
+/* what to do when no free page is left in the group's bins */
+enum palloc_policy {
+	PALLOC_POLICY_PREFERRED,	/* neighbouring colors, then any */
+	PALLOC_POLICY_STRICT,		/* fail, i.e. reclaim, within the bins */
+	PALLOC_POLICY_INTERLEAVE,	/* preferred, colors used round-robin */
+	NR_PALLOC_POLICIES
+};
+
+/* allocation latency histogram buckets: [2^i, 2^(i+1)) ns */
+#define PALLOC_LAT_BUCKETS 32
+
+struct palloc_cpu_stat {
+	u64 count[NR_PALLOC_STAT_ITEMS];
+	u64 latency[PALLOC_LAT_BUCKETS];
+	u64 color[MAX_PALLOC_BINS];	/* pages allocated per color */
+	u64 freed[MAX_PALLOC_BINS];	/* pages of those freed per color */
+};
+
 struct palloc {
 	struct cgroup_subsys_state css;
+	/*
+	 * bins the allocator uses: intersection of the maps below, or the
+	 * parent's bins less those of exclusive siblings if none is set
+	 */
 	COLOR_BITMAP(cmap);
+	unsigned int nr_cmap;		/* colors in cmap, 0: no restriction */
+	spinlock_t lock;		/* protects cmap updates */
+
+	COLOR_BITMAP(bins);		/* allowed colors */
+	COLOR_BITMAP(cache_bins);	/* allowed cache colors */
+	COLOR_BITMAP(bank_bins);	/* allowed banks */
+	int exclusive;			/* no sibling may share the bins */
+	int policy;			/* enum palloc_policy */
+	unsigned int interleave_next;	/* next color to interleave from */
+
+	struct palloc_cpu_stat __percpu *stat;
+	unsigned int serial;		/* tells apart groups of one css id */
+
+	/* pool of free pages in the bins, pinned for the group's faults */
+	spinlock_t pool_lock;
+	struct list_head *pool;		/* per zone, see palloc_pool() */
+	unsigned long nr_pool;
+	unsigned long *node_pool;	/* pages of the pool per node */
+	unsigned long reserve;		/* pool size to keep, over all nodes */
+	struct list_head reserve_node;	/* queued for a refill */
+
+	/* recoloring of resident pages when the bins change */
+	int migrate;			/* migrate on rebin */
+	u64 migrate_rate;		/* pages per second, 0: unlimited */
+	struct list_head recolor_node;	/* queued for kpallocd */
+	u64 nr_scanned;
+	u64 nr_migrated;
+	u64 nr_failed;
+	u64 migrate_ns;
+
+	struct rcu_head rcu;		/* css_lookup() users may still see it */
 };
 
 /* Retrieve the palloc group corresponding to this cgroup container */
@@ -25,9 +91,157 @@ struct palloc *cgroup_ph(struct cgroup *cgrp);
 /* Retrieve the palloc group corresponding to this subsys */
 struct palloc * ph_from_subsys(struct cgroup_subsys_state * subsys);
 
+/*
+ * A key telling a group apart from those that used its css id before,
+ * kept for a page to find the group it was allocated for.
+ */
+static inline u32 palloc_owner(struct palloc *ph)
+{
+	return ((u32)css_id(&ph->css) << 16) | (ph->serial & 0xffff);
+}
+
+/* return the live group of an owner key, under rcu_read_lock() */
+struct palloc *palloc_owner_group(u32 owner);
+
+/* the root group, which interrupt context allocates for */
+struct palloc *palloc_top(void);
+
+/* the group a page was allocated for, under rcu_read_lock() */
+struct palloc *palloc_page_group(struct page *page);
+
+/* the group of the owner of mm with a reference held, or NULL */
+struct palloc *palloc_get_mm_group(struct mm_struct *mm);
+
+static inline void palloc_put_group(struct palloc *ph)
+{
+	if (ph)
+		css_put(&ph->css);
+}
+
+/*
+ * Whether ph (NULL: the current task's group) can be given an order block
+ * in its bins, and whether the order block at page is in them.
+ */
+int palloc_order_fits(struct palloc *ph, int order);
+int palloc_block_fits(struct palloc *ph, struct page *page, int order);
+
+/* the group the page cache of mapping is allocated for, referenced */
+struct palloc *palloc_get_mapping_group(struct address_space *mapping);
+
+/* allocate up to nr order-0 pages in the bins of ph onto list */
+unsigned long palloc_alloc_pages_bulk(struct palloc *ph, gfp_t gfp_mask,
+				      unsigned long nr, struct list_head *list);
+
+/* have the pages of a split huge page recolored if out of its bins */
+void palloc_split_huge_page(struct page *page);
+
 /* return #of palloc bins */
 int palloc_bins(void);
 
+/* return the color of a page */
+int palloc_page_color(struct page *page);
+
+/* return the color bits that select a cache color, the rest select a bank */
+int palloc_cache_mask(void);
+
+/* recompute the bins of all groups after a color configuration change */
+void palloc_rebuild_cmaps(void);
+
+/* start and stop the color cache rebalancer of a node */
+int kcolord_run(int nid);
+void kcolord_stop(int nid);
+
+/* the reserve pool list of ph that holds the pages of zone */
+static inline struct list_head *palloc_pool(struct palloc *ph,
+					    struct zone *zone)
+{
+	return &ph->pool[zone_to_nid(zone) * MAX_NR_ZONES + zone_idx(zone)];
+}
+
+/* refill the reserve pool once it falls below this many pages */
+static inline unsigned long palloc_reserve_low(struct palloc *ph)
+{
+	return ph->reserve - ph->reserve / 4;
+}
+
+/* top up the reserve pool of ph, return the number of pages in it */
+unsigned long palloc_reserve_fill(struct palloc *ph);
+
+/* free reserve pool pages of ph until at most keep are left */
+void palloc_reserve_drain(struct palloc *ph, unsigned long keep);
+
+/* have kpallocd refill the reserve pool of ph */
+void palloc_queue_refill(struct palloc *ph);
+
+/* drain or refill the reserve pools of all groups as palloc is toggled */
+void palloc_reserve_toggled(void);
+
+/*
+ * Make the current task allocate from the bins of ph instead of its own
+ * cgroup's (ph == NULL restores the default). Returns the previous value.
+ */
+static inline struct palloc *palloc_set_current(struct palloc *ph)
+{
+	struct palloc *old = current->palloc;
+
+	current->palloc = ph;
+	return old;
+}
+
+#else /* !CONFIG_CGROUP_PALLOC */
+
+struct palloc;
+
+static inline struct palloc *palloc_get_mm_group(struct mm_struct *mm)
+{
+	return NULL;
+}
+
+static inline struct palloc *
+palloc_get_mapping_group(struct address_space *mapping)
+{
+	return NULL;
+}
+
+static inline void palloc_put_group(struct palloc *ph)
+{
+}
+
+static inline unsigned long palloc_alloc_pages_bulk(struct palloc *ph,
+		gfp_t gfp_mask, unsigned long nr, struct list_head *list)
+{
+	return 0;
+}
+
+static inline int palloc_order_fits(struct palloc *ph, int order)
+{
+	return 1;
+}
+
+static inline int palloc_block_fits(struct palloc *ph, struct page *page,
+				    int order)
+{
+	return 1;
+}
+
+static inline void palloc_split_huge_page(struct page *page)
+{
+}
+
+static inline struct palloc *palloc_set_current(struct palloc *ph)
+{
+	return NULL;
+}
+
+static inline int kcolord_run(int nid)
+{
+	return 0;
+}
+
+static inline void kcolord_stop(int nid)
+{
+}
+
 #endif /* CONFIG_CGROUP_PALLOC */
 
 #endif /* _LINUX_PALLOC_H */
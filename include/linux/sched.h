@@ -1505,6 +1505,14 @@ struct task_struct {
 	/* cg_list protected by css_set_lock and tsk->alloc_lock */
 	struct list_head cg_list;
 #endif
+#ifdef CONFIG_CGROUP_PALLOC
+	/* palloc group to allocate from instead of the task's cgroup */
+	struct palloc *palloc;
+	/* the allocation in progress gave up on the strict policy */
+	int palloc_nostrict;
+	/* colors of the memory policy the allocation in progress obeys */
+	const unsigned long *palloc_colors;
+#endif
 #ifdef CONFIG_FUTEX
 	struct robust_list_head __user *robust_list;
 #ifdef CONFIG_COMPAT
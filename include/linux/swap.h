@@ -281,6 +281,26 @@ static inline int zone_reclaim(struct zone *z, gfp_t mask, unsigned int order)
 }
 #endif
 
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_add_mm(struct mm_struct *mm);
+extern void lru_gen_exit_mm(struct mm_struct *mm);
+extern void lru_gen_del_mm(struct mm_struct *mm);
+extern void lru_gen_convert_lruvec(struct lruvec *lruvec, bool enable);
+#else
+static inline void lru_gen_add_mm(struct mm_struct *mm)
+{
+}
+static inline void lru_gen_exit_mm(struct mm_struct *mm)
+{
+}
+static inline void lru_gen_del_mm(struct mm_struct *mm)
+{
+}
+static inline void lru_gen_convert_lruvec(struct lruvec *lruvec, bool enable)
+{
+}
+#endif
+
 extern int page_evictable(struct page *page, struct vm_area_struct *vma);
 extern void check_move_unevictable_pages(struct page **, int nr_pages);
 
@@ -300,6 +320,9 @@ static inline void scan_unevictable_unregister_node(struct node *node)
 }
 #endif
 
+extern int kswapd_threads;
+extern int kswapd_threads_sysctl_handler(struct ctl_table *, int,
+					 void __user *, size_t *, loff_t *);
 extern int kswapd_run(int nid);
 extern void kswapd_stop(int nid);
 #ifdef CONFIG_MEMCG
@@ -0,0 +1,194 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM palloc
+
+#if !defined(_TRACE_PALLOC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_PALLOC_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/mm.h>
+#include <linux/palloc.h>
+
+/* outcome of an allocation, see palloc_account() */
+#define show_palloc_result(result)					\
+	__print_symbolic(result,					\
+		{ PALLOC_HIT,		"hit" },			\
+		{ PALLOC_MISS,		"miss" },			\
+		{ PALLOC_FALLBACK,	"fallback" },			\
+		{ PALLOC_FAIL,		"fail" },			\
+		{ PALLOC_NEIGHBOR,	"neighbor" })
+
+TRACE_EVENT(palloc_alloc,
+
+	TP_PROTO(struct page *page, unsigned int order, int color,
+		 int result, unsigned int iters, u64 latency, u32 owner),
+
+	TP_ARGS(page, order, color, result, iters, latency, owner),
+
+	TP_STRUCT__entry(
+		__field(unsigned long,	pfn)
+		__field(unsigned int,	order)
+		__field(int,		color)
+		__field(int,		result)
+		__field(unsigned int,	iters)
+		__field(u64,		latency)
+		__field(u32,		owner)
+	),
+
+	TP_fast_assign(
+		__entry->pfn		= page ? page_to_pfn(page) : -1UL;
+		__entry->order		= order;
+		__entry->color		= color;
+		__entry->result		= result;
+		__entry->iters		= iters;
+		__entry->latency	= latency;
+		__entry->owner		= owner;
+	),
+
+	TP_printk("pfn=0x%lx order=%u color=%d result=%s iters=%u latency_ns=%llu owner=0x%x",
+		__entry->pfn,
+		__entry->order,
+		__entry->color,
+		show_palloc_result(__entry->result),
+		__entry->iters,
+		__entry->latency,
+		__entry->owner)
+);
+
+TRACE_EVENT(palloc_insert,
+
+	TP_PROTO(struct zone *zone, struct page *page, unsigned int order),
+
+	TP_ARGS(zone, page, order),
+
+	TP_STRUCT__entry(
+		__field(int,		nid)
+		__field(int,		zid)
+		__field(unsigned long,	pfn)
+		__field(unsigned int,	order)
+	),
+
+	TP_fast_assign(
+		__entry->nid		= zone_to_nid(zone);
+		__entry->zid		= zone_idx(zone);
+		__entry->pfn		= page_to_pfn(page);
+		__entry->order		= order;
+	),
+
+	TP_printk("nid=%d zid=%d pfn=0x%lx order=%u",
+		__entry->nid,
+		__entry->zid,
+		__entry->pfn,
+		__entry->order)
+);
+
+TRACE_EVENT(palloc_find_cmap,
+
+	TP_PROTO(struct page *page, int color, int found_w, int want_w),
+
+	TP_ARGS(page, color, found_w, want_w),
+
+	TP_STRUCT__entry(
+		__field(unsigned long,	pfn)
+		__field(int,		color)
+		__field(int,		found_w)
+		__field(int,		want_w)
+	),
+
+	TP_fast_assign(
+		__entry->pfn		= page_to_pfn(page);
+		__entry->color		= color;
+		__entry->found_w	= found_w;
+		__entry->want_w		= want_w;
+	),
+
+	TP_printk("pfn=0x%lx color=%d found/want=%d/%d",
+		__entry->pfn,
+		__entry->color,
+		__entry->found_w,
+		__entry->want_w)
+);
+
+DECLARE_EVENT_CLASS(palloc_zone_template,
+
+	TP_PROTO(struct zone *zone, unsigned long nr),
+
+	TP_ARGS(zone, nr),
+
+	TP_STRUCT__entry(
+		__field(int,		nid)
+		__field(int,		zid)
+		__field(unsigned long,	nr)
+	),
+
+	TP_fast_assign(
+		__entry->nid		= zone_to_nid(zone);
+		__entry->zid		= zone_idx(zone);
+		__entry->nr		= nr;
+	),
+
+	TP_printk("nid=%d zid=%d nr=%lu",
+		__entry->nid,
+		__entry->zid,
+		__entry->nr)
+);
+
+/* nr: free blocks visited to fill the color cache */
+DEFINE_EVENT(palloc_zone_template, palloc_build,
+
+	TP_PROTO(struct zone *zone, unsigned long nr),
+
+	TP_ARGS(zone, nr)
+);
+
+/* nr: free blocks regrouped by color key */
+DEFINE_EVENT(palloc_zone_template, palloc_index_rebuild,
+
+	TP_PROTO(struct zone *zone, unsigned long nr),
+
+	TP_ARGS(zone, nr)
+);
+
+/* nr: pages given back from the color cache to the buddy allocator */
+DEFINE_EVENT(palloc_zone_template, palloc_flush,
+
+	TP_PROTO(struct zone *zone, unsigned long nr),
+
+	TP_ARGS(zone, nr)
+);
+
+TRACE_EVENT(palloc_fallback,
+
+	TP_PROTO(struct zone *zone, unsigned int order, int migratetype,
+		 int strict),
+
+	TP_ARGS(zone, order, migratetype, strict),
+
+	TP_STRUCT__entry(
+		__field(int,		nid)
+		__field(int,		zid)
+		__field(unsigned int,	order)
+		__field(int,		migratetype)
+		__field(int,		strict)
+	),
+
+	TP_fast_assign(
+		__entry->nid		= zone_to_nid(zone);
+		__entry->zid		= zone_idx(zone);
+		__entry->order		= order;
+		__entry->migratetype	= migratetype;
+		__entry->strict		= strict;
+	),
+
+	TP_printk("nid=%d zid=%d order=%u migratetype=%d strict=%d",
+		__entry->nid,
+		__entry->zid,
+		__entry->order,
+		__entry->migratetype,
+		__entry->strict)
+);
+
+#endif /* _TRACE_PALLOC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
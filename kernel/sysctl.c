@@ -132,6 +132,9 @@ static int one_hundred = 100;
 static int ten_thousand = 10000;
 #endif
 
+/* this is needed for the proc_dointvec_minmax of vm_kswapd_threads */
+static int max_kswapd_threads = MAX_KSWAPD_THREADS;
+
 /* this is needed for the proc_doulongvec_minmax of vm_dirty_bytes */
 static unsigned long dirty_bytes_min = 2 * PAGE_SIZE;
 
@@ -259,6 +262,8 @@ static int max_sched_tunable_scaling = SCHED_TUNABLESCALING_END-1;
 #ifdef CONFIG_COMPACTION
 static int min_extfrag_threshold;
 static int max_extfrag_threshold = 1000;
+static int min_kcompactd_interval_ms = 10;
+static int max_kcompactd_interval_ms = 60000;
 #endif
 
 static struct ctl_table kern_table[] = {
@@ -1114,6 +1119,15 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
 	},
+	{
+		.procname	= "kswapd_threads",
+		.data		= &kswapd_threads,
+		.maxlen		= sizeof(kswapd_threads),
+		.mode		= 0644,
+		.proc_handler	= kswapd_threads_sysctl_handler,
+		.extra1		= &one,
+		.extra2		= &max_kswapd_threads,
+	},
 #ifdef CONFIG_HUGETLB_PAGE
 	{
 		.procname	= "nr_hugepages",
@@ -1192,6 +1206,33 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "kcompactd_free_pct",
+		.data		= &sysctl_kcompactd_free_pct,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+	{
+		.procname	= "kcompactd_interval_ms",
+		.data		= &sysctl_kcompactd_interval_ms,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &min_kcompactd_interval_ms,
+		.extra2		= &max_kcompactd_interval_ms,
+	},
+	{
+		.procname	= "kcompactd_cpu_pct",
+		.data		= &sysctl_kcompactd_cpu_pct,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &one_hundred,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1210,6 +1251,26 @@ static struct ctl_table vm_table[] = {
 		.proc_handler	= percpu_pagelist_fraction_sysctl_handler,
 		.extra1		= &min_percpu_pagelist_fract,
 	},
+	{
+		.procname	= "percpu_pagelist_autotune",
+		.data		= &percpu_pagelist_autotune,
+		.maxlen		= sizeof(percpu_pagelist_autotune),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#ifdef CONFIG_LRU_GEN
+	{
+		.procname	= "lru_gen_enabled",
+		.data		= &sysctl_lru_gen_enabled,
+		.maxlen		= sizeof(sysctl_lru_gen_enabled),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
 #ifdef CONFIG_MMU
 	{
 		.procname	= "max_map_count",
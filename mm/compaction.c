@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/palloc.h>
 #include "internal.h"
 
 #if defined CONFIG_COMPACTION || defined CONFIG_CMA
@@ -91,6 +94,43 @@ static inline bool compact_trylock_irqsave(spinlock_t *lock,
 	return compact_checklock_irqsave(lock, flags, false, cc);
 }
 
+/*
+ * The lru lock to take depends on the memcg of each page, so the migration
+ * scanner only holds the lock of the lruvec it last looked at, if any.
+ * Drop it if the process needs to be scheduled or the lock is contended,
+ * and back out or schedule as compact_checklock_irqsave() does.
+ *
+ * Returns false if compaction should abort, with no lock held.
+ */
+static bool compact_checklock_lruvec(struct lruvec **locked,
+				     unsigned long *flags,
+				     struct compact_control *cc)
+{
+	bool contended = false;
+
+	if (*locked) {
+		contended = spin_is_contended((*locked)->lru_lock);
+		if (!contended && !need_resched())
+			return true;
+		unlock_lruvec_irqrestore(*locked, *flags);
+		*locked = NULL;
+	}
+
+	if (contended || need_resched()) {
+		/* async aborts if taking too long or contended */
+		if (!cc->sync) {
+			if (cc->contended)
+				*cc->contended = true;
+			return false;
+		}
+
+		cond_resched();
+		if (fatal_signal_pending(current))
+			return false;
+	}
+	return true;
+}
+
 /*
  * Isolate free pages onto a private freelist. Caller must hold zone->lock.
  * If @strict is true, will abort returning 0 on any invalid PFNs or non-free
@@ -274,9 +314,8 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 	unsigned long nr_scanned = 0, nr_isolated = 0;
 	struct list_head *migratelist = &cc->migratepages;
 	isolate_mode_t mode = 0;
-	struct lruvec *lruvec;
+	struct lruvec *locked = NULL;
 	unsigned long flags;
-	bool locked;
 
 	/*
 	 * Ensure that there are not too many pages isolated from the LRU
@@ -296,21 +335,17 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 
 	/* Time to isolate some pages for migration */
 	cond_resched();
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	locked = true;
 	for (; low_pfn < end_pfn; low_pfn++) {
 		struct page *page;
 
 		/* give a chance to irqs before checking need_resched() */
-		if (!((low_pfn+1) % SWAP_CLUSTER_MAX)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
-			locked = false;
+		if (locked && !((low_pfn+1) % SWAP_CLUSTER_MAX)) {
+			unlock_lruvec_irqrestore(locked, flags);
+			locked = NULL;
 		}
 
 		/* Check if it is ok to still hold the lock */
-		locked = compact_checklock_irqsave(&zone->lru_lock, &flags,
-								locked, cc);
-		if (!locked)
+		if (!compact_checklock_lruvec(&locked, &flags, cc))
 			break;
 
 		/*
@@ -358,6 +393,10 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 			continue;
 		}
 
+		if (!PageLRU(page))
+			continue;
+
+		locked = relock_page_lruvec_irqsave(page, locked, &flags);
 		if (!PageLRU(page))
 			continue;
 
@@ -374,8 +413,6 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 		if (!cc->sync)
 			mode |= ISOLATE_ASYNC_MIGRATE;
 
-		lruvec = mem_cgroup_page_lruvec(page, zone);
-
 		/* Try isolate the page */
 		if (__isolate_lru_page(page, mode) != 0)
 			continue;
@@ -383,7 +420,7 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 		VM_BUG_ON(PageTransCompound(page));
 
 		/* Successfully isolated */
-		del_page_from_lru_list(page, lruvec, page_lru(page));
+		del_page_from_lru_list(page, locked, page_lru(page));
 		list_add(&page->lru, migratelist);
 		cc->nr_migratepages++;
 		nr_isolated++;
@@ -395,10 +432,10 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 		}
 	}
 
-	acct_isolated(zone, locked, cc);
+	acct_isolated(zone, locked != NULL, cc);
 
 	if (locked)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		unlock_lruvec_irqrestore(locked, flags);
 
 	trace_mm_compaction_isolate_migratepages(nr_scanned, nr_isolated);
 
@@ -562,6 +599,29 @@ static void isolate_freepages(struct zone *zone,
  * This is a migrate-callback that "allocates" freepages by taking pages
  * from the isolated freelists in the block we are migrating to.
  */
+#ifdef CONFIG_CGROUP_PALLOC
+/*
+ * Find a free page of the color of migratepage, so that compaction does
+ * not undo the cache and bank partitioning of palloc groups. Look at the
+ * isolated free pages first, then at the color cache.
+ */
+static struct page *compaction_alloc_color(struct compact_control *cc,
+					   struct page *migratepage)
+{
+	int color = palloc_page_color(migratepage);
+	struct page *freepage;
+
+	list_for_each_entry(freepage, &cc->freepages, lru) {
+		if (palloc_page_color(freepage) == color) {
+			list_del(&freepage->lru);
+			cc->nr_freepages--;
+			return freepage;
+		}
+	}
+	return palloc_isolate_color_page(cc->zone, color, cc->free_pfn);
+}
+#endif
+
 static struct page *compaction_alloc(struct page *migratepage,
 					unsigned long data,
 					int **result)
@@ -569,6 +629,14 @@ static struct page *compaction_alloc(struct page *migratepage,
 	struct compact_control *cc = (struct compact_control *)data;
 	struct page *freepage;
 
+#ifdef CONFIG_CGROUP_PALLOC
+	if (palloc_enabled()) {
+		freepage = compaction_alloc_color(cc, migratepage);
+		if (freepage)
+			return freepage;
+	}
+#endif
+
 	/* Isolate free pages if necessary */
 	if (list_empty(&cc->freepages)) {
 		isolate_freepages(cc->zone, cc);
@@ -642,6 +710,17 @@ static isolate_migrate_t isolate_migratepages(struct zone *zone,
 	return ISOLATE_SUCCESS;
 }
 
+/* Free blocks of @order the free lists of @zone could hand out */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr += zone->free_area[o].nr_free << (o - order);
+	return nr;
+}
+
 static int compact_finished(struct zone *zone,
 			    struct compact_control *cc)
 {
@@ -651,6 +730,10 @@ static int compact_finished(struct zone *zone,
 	if (fatal_signal_pending(current))
 		return COMPACT_PARTIAL;
 
+	/* kcompactd used up the CPU budget of this run */
+	if (cc->deadline && time_after(jiffies, cc->deadline))
+		return COMPACT_PARTIAL;
+
 	/*
 	 * A full (order == -1) compaction run starts at the beginning and
 	 * end of a zone; it completes when the migrate and free scanner meet.
@@ -687,6 +770,11 @@ static int compact_finished(struct zone *zone,
 	if (!zone_watermark_ok(zone, cc->order, watermark, 0, 0))
 		return COMPACT_CONTINUE;
 
+	/* Proactive compaction: are there enough free blocks? */
+	if (cc->nr_target)
+		return zone_free_blocks(zone, cc->order) >= cc->nr_target ?
+			COMPACT_PARTIAL : COMPACT_CONTINUE;
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -758,6 +846,10 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	ret = compaction_suitable(zone, cc->order);
 	switch (ret) {
 	case COMPACT_PARTIAL:
+		/* Proactive compaction wants more than one free block */
+		if (cc->nr_target)
+			break;
+		/* fall through */
 	case COMPACT_SKIPPED:
 		/* Compaction is likely to fail */
 		return ret;
@@ -766,6 +858,15 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 		;
 	}
 
+#ifdef CONFIG_CGROUP_PALLOC
+	/*
+	 * Compaction is going to run: let the buddy allocator merge the
+	 * color cache pages first. Not for the calls that bail out above,
+	 * kcolord trims the cache in the background.
+	 */
+	palloc_release_cold(zone);
+#endif
+
 	/* Setup to move all movable pages to the end of the zone */
 	cc->migrate_pfn = zone->zone_start_pfn;
 
@@ -803,6 +904,9 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 
 		count_vm_event(COMPACTBLOCKS);
 		count_vm_events(COMPACTPAGES, nr_migrate - nr_remaining);
+		if (cc->kcompactd)
+			count_vm_events(KCOMPACTD_PAGES,
+					nr_migrate - nr_remaining);
 		if (nr_remaining)
 			count_vm_events(COMPACTPAGEFAILED, nr_remaining);
 		trace_mm_compaction_migratepages(nr_migrate - nr_remaining,
@@ -935,16 +1039,6 @@ static int __compact_pgdat(pg_data_t *pgdat, struct compact_control *cc)
 	return 0;
 }
 
-int compact_pgdat(pg_data_t *pgdat, int order)
-{
-	struct compact_control cc = {
-		.order = order,
-		.sync = false,
-	};
-
-	return __compact_pgdat(pgdat, &cc);
-}
-
 static int compact_node(int nid)
 {
 	struct compact_control cc = {
@@ -1019,4 +1113,224 @@ void compaction_unregister_node(struct node *node)
 }
 #endif /* CONFIG_SYSFS && CONFIG_NUMA */
 
+/*
+ * kcompactd compacts a node in the background: on behalf of kswapd when a
+ * high-order allocation woke it, and ahead of demand when too little of
+ * the free memory of a zone is in free pageblocks. Each run may take
+ * sysctl_kcompactd_cpu_pct percent of the sysctl_kcompactd_interval_ms
+ * period it wakes at, and it sleeps long enough after a run not to take
+ * more than that share of a CPU on average.
+ */
+int sysctl_kcompactd_free_pct = 20;
+int sysctl_kcompactd_interval_ms = 500;
+int sysctl_kcompactd_cpu_pct = 10;
+
+/* Periods a zone is left alone after compacting it did not help */
+#define KCOMPACTD_DEFER_PERIODS	16
+
+/*
+ * The free pageblocks of a zone are scarce when they hold less than half
+ * of sysctl_kcompactd_free_pct percent of its free memory, and compaction
+ * then runs until they hold the full percentage. Like compaction_suitable()
+ * this leaves alone zones that are short of free memory rather than
+ * fragmented.
+ */
+static unsigned long kcompactd_zone_target(struct zone *zone)
+{
+	unsigned long free = zone_page_state(zone, NR_FREE_PAGES);
+	unsigned long watermark;
+	int fragindex;
+
+	if (!sysctl_kcompactd_free_pct || (zone->kcompactd_defer_until &&
+	    time_before(jiffies, zone->kcompactd_defer_until)))
+		return 0;
+
+	if ((zone_free_blocks(zone, pageblock_order) << pageblock_order) * 200 >=
+	    free * sysctl_kcompactd_free_pct)
+		return 0;
+
+	watermark = low_wmark_pages(zone) + (2UL << pageblock_order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	fragindex = fragmentation_index(zone, pageblock_order);
+	if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+		return 0;
+
+	return max(1UL, (free * sysctl_kcompactd_free_pct / 100) >>
+			pageblock_order);
+}
+
+/*
+ * Compact the zones of a node kswapd asked for or that are short of free
+ * pageblocks, until done or out of budget.
+ */
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	unsigned long budget = msecs_to_jiffies((unsigned long)
+			sysctl_kcompactd_interval_ms * sysctl_kcompactd_cpu_pct / 100);
+	unsigned long deadline = jiffies + max(budget, 1UL);
+	int order = pgdat->kcompactd_max_order;
+	int classzone_idx = pgdat->kcompactd_classzone_idx;
+	bool woken = false;
+	struct zone *zone;
+	int zoneid;
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	for (zoneid = 0; zoneid < pgdat->nr_zones; zoneid++) {
+		struct compact_control cc = {
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = true,
+			.kcompactd = true,
+			.deadline = deadline,
+		};
+		int ret;
+
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (order && zoneid <= classzone_idx &&
+		    !compaction_deferred(zone, order) &&
+		    compaction_suitable(zone, order) == COMPACT_CONTINUE) {
+			cc.order = order;
+		} else {
+			cc.nr_target = kcompactd_zone_target(zone);
+			if (!cc.nr_target)
+				continue;
+			cc.order = pageblock_order;
+		}
+
+		if (!woken) {
+			count_vm_event(KCOMPACTD_WAKE);
+			woken = true;
+		}
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+		ret = compact_zone(zone, &cc);
+
+		if (!cc.nr_target) {
+			if (zone_watermark_ok(zone, order,
+					      low_wmark_pages(zone), 0, 0)) {
+				if (order >= zone->compact_order_failed)
+					zone->compact_order_failed = order + 1;
+			} else if (ret == COMPACT_COMPLETE) {
+				defer_compaction(zone, order);
+			}
+		} else if (ret == COMPACT_COMPLETE &&
+			   zone_free_blocks(zone, cc.order) < cc.nr_target) {
+			zone->kcompactd_defer_until = jiffies +
+				KCOMPACTD_DEFER_PERIODS *
+				msecs_to_jiffies(sysctl_kcompactd_interval_ms);
+		}
+
+		if (time_after(jiffies, deadline)) {
+			count_vm_event(KCOMPACTD_THROTTLED);
+			return;
+		}
+		if (kthread_should_stop())
+			return;
+	}
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	unsigned long start, spent;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kthread_should_stop() ||
+				pgdat->kcompactd_max_order,
+				msecs_to_jiffies(sysctl_kcompactd_interval_ms));
+		if (kthread_should_stop())
+			break;
+
+		start = jiffies;
+		kcompactd_do_work(pgdat);
+		spent = jiffies - start;
+
+		/* keep to sysctl_kcompactd_cpu_pct of a CPU, wakeups or not */
+		if (spent && sysctl_kcompactd_cpu_pct < 100)
+			wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kthread_should_stop(),
+				spent * (100 - sysctl_kcompactd_cpu_pct) /
+				sysctl_kcompactd_cpu_pct);
+	}
+	return 0;
+}
+
+/*
+ * Called by kswapd when it balanced a node for a high-order allocation,
+ * compaction is left to kcompactd so that kswapd can go back to sleep.
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * Called by init and node-hot-add, like kswapd_run().
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		pr_err("Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.  Caller must
+ * hold lock_memory_hotplug().
+ */
+void kcompactd_stop(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcompactd) {
+		kthread_stop(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #endif /* CONFIG_COMPACTION */
@@ -17,6 +17,7 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/palloc.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -709,8 +710,13 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			return VM_FAULT_OOM;
 		if (unlikely(khugepaged_enter(vma)))
 			return VM_FAULT_OOM;
-		page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
-					  vma, haddr, numa_node_id(), 0);
+		/* a huge page would not fit in the bins of the group */
+		if (!palloc_order_fits(NULL, HPAGE_PMD_ORDER))
+			page = NULL;
+		else
+			page = alloc_hugepage_vma(
+					transparent_hugepage_defrag(vma),
+					vma, haddr, numa_node_id(), 0);
 		if (unlikely(!page)) {
 			count_vm_event(THP_FAULT_FALLBACK);
 			goto out;
@@ -942,7 +948,8 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	spin_unlock(&mm->page_table_lock);
 
 	if (transparent_hugepage_enabled(vma) &&
-	    !transparent_hugepage_debug_cow())
+	    !transparent_hugepage_debug_cow() &&
+	    palloc_order_fits(NULL, HPAGE_PMD_ORDER))
 		new_page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
 					      vma, haddr, numa_node_id(), 0);
 	else
@@ -1235,10 +1242,18 @@ static void __split_huge_page_refcount(struct page *page)
 	int tail_count = 0;
 
 	/* prevent PageLRU to go away from under us, and freeze lru stats */
-	spin_lock_irq(&zone->lru_lock);
-	lruvec = mem_cgroup_page_lruvec(page, zone);
+	lruvec = lock_page_lruvec_irq(page);
 
 	compound_lock(page);
+	/*
+	 * mem_cgroup_move_account() may have moved the page to another
+	 * memcg under the compound_lock while we waited for it.
+	 */
+	while (!page_in_lruvec(page, lruvec)) {
+		compound_unlock(page);
+		lruvec = relock_page_lruvec_irq(page, lruvec);
+		compound_lock(page);
+	}
 	/* complete memcg works before add pages to LRU */
 	mem_cgroup_split_huge_fixup(page);
 
@@ -1322,7 +1337,7 @@ static void __split_huge_page_refcount(struct page *page)
 
 	ClearPageCompound(page);
 	compound_unlock(page);
-	spin_unlock_irq(&zone->lru_lock);
+	unlock_lruvec_irq(lruvec);
 
 	for (i = 1; i < HPAGE_PMD_NR; i++) {
 		struct page *page_tail = page + i;
@@ -1483,6 +1498,7 @@ int split_huge_page(struct page *page)
 	BUG_ON(!PageSwapBacked(page));
 	__split_huge_page(page, anon_vma);
 	count_vm_event(THP_SPLIT);
+	palloc_split_huge_page(page);
 
 	BUG_ON(PageCompound(page));
 out_unlock:
@@ -1854,6 +1870,19 @@ static void collapse_huge_page(struct mm_struct *mm,
 	up_read(&mm->mmap_sem);
 	VM_BUG_ON(!*hpage);
 	new_page = *hpage;
+	if (!palloc_block_fits(NULL, new_page, HPAGE_PMD_ORDER)) {
+		/*
+		 * Allocated ahead for no group in particular, replace it
+		 * by one in the bins of the group of mm, see
+		 * khugepaged_scan_mm_slot().
+		 */
+		put_page(new_page);
+		*hpage = new_page = alloc_hugepage(khugepaged_defrag());
+		if (unlikely(!new_page)) {
+			count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+			return;
+		}
+	}
 #else
 	VM_BUG_ON(*hpage);
 	/*
@@ -2111,6 +2140,7 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
+	struct palloc *ph, *old_ph;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
@@ -2127,8 +2157,15 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	spin_unlock(&khugepaged_mm_lock);
 
 	mm = mm_slot->mm;
+	/*
+	 * Collapse into huge pages in the bins of the group of mm, or not
+	 * at all if no huge page fits in them.
+	 */
+	ph = palloc_get_mm_group(mm);
+	old_ph = palloc_set_current(ph);
 	down_read(&mm->mmap_sem);
-	if (unlikely(khugepaged_test_exit(mm)))
+	if (unlikely(khugepaged_test_exit(mm)) ||
+	    !palloc_order_fits(ph, HPAGE_PMD_ORDER))
 		vma = NULL;
 	else
 		vma = find_vma(mm, khugepaged_scan.address);
@@ -2196,6 +2233,8 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 breakouterloop:
 	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
 breakouterloop_mmap_sem:
+	palloc_set_current(old_ph);
+	palloc_put_group(ph);
 
 	spin_lock(&khugepaged_mm_lock);
 	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
@@ -131,6 +131,12 @@ struct compact_control {
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
 	bool *contended;		/* True if a lock was contended */
+
+	bool kcompactd;			/* Run by kcompactd */
+	unsigned long deadline;		/* jiffies a kcompactd run ends by */
+	unsigned long nr_target;	/* Free blocks of order kcompactd
+					   compacts towards, 0 if it only
+					   needs one */
 };
 
 unsigned long
@@ -141,6 +147,16 @@ isolate_migratepages_range(struct zone *zone, struct compact_control *cc,
 
 #endif
 
+#ifdef CONFIG_CGROUP_PALLOC
+/* true if the allocator hands out pages by color */
+int palloc_enabled(void);
+/* give the color cache pages no group allocated from lately back */
+void palloc_release_cold(struct zone *zone);
+/* take a free page of a color at or above min_pfn out of the color cache */
+struct page *palloc_isolate_color_page(struct zone *zone, int color,
+				       unsigned long min_pfn);
+#endif
+
 /*
  * function for dealing with page's order in buddy system.
  * zone->lock is already acquired when we use these.
@@ -26,6 +26,7 @@
 #include <linux/cgroup.h>
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/hash.h>
 #include <linux/pagemap.h>
 #include <linux/smp.h>
 #include <linux/page-flags.h>
@@ -1081,39 +1082,124 @@ struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
  * It is added to LRU before charge.
  * If PCG_USED bit is not set, page_cgroup is not added to this private LRU.
  * When moving account, the page is not on LRU. It's isolated.
+ * Either way pc->mem_cgroup is written under the lru lock of the lruvec it
+ * pointed to, see mem_cgroup_relock_page_lruvec().
  */
 
 /**
- * mem_cgroup_page_lruvec - return lruvec for adding an lru page
+ * mem_cgroup_lru_lock - get the lru lock for a zone and memcg
+ * @zone: zone of the lruvec
+ * @memcg: memcg of the lruvec, may be stale or NULL
+ *
+ * Only the pointer value of @memcg is used, so this is safe to call on
+ * the pc->mem_cgroup of an uncharged page whose memcg is already gone.
+ */
+static spinlock_t *mem_cgroup_lru_lock(struct zone *zone,
+				       struct mem_cgroup *memcg)
+{
+	return &zone->lru_locks[hash_ptr(memcg, LRU_LOCK_BITS)].lock;
+}
+
+/**
+ * mem_cgroup_relock_page_lruvec - lock the lruvec of an lru page
  * @page: the page
- * @zone: zone of the page
+ * @locked: lruvec whose lru lock the caller holds, or NULL
+ *
+ * Returns the lruvec @page belongs to with its lru lock held, dropping
+ * the lock of @locked first if it is a different one.  Interrupts must
+ * be disabled.
+ *
+ * pc->mem_cgroup only changes under the lru lock of the lruvec it
+ * names, so it is stable until the returned lruvec is unlocked.  The
+ * one exception is an isolated THP, moved under its compound_lock, see
+ * mem_cgroup_move_account().
  */
-struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
+struct lruvec *mem_cgroup_relock_page_lruvec(struct page *page,
+					     struct lruvec *locked)
 {
-	struct mem_cgroup_per_zone *mz;
+	struct zone *zone = page_zone(page);
+	spinlock_t *held = locked ? locked->lru_lock : NULL;
 	struct mem_cgroup *memcg;
 	struct page_cgroup *pc;
-
-	if (mem_cgroup_disabled())
+	spinlock_t *lock;
+
+	if (mem_cgroup_disabled()) {
+		lock = zone->lruvec.lru_lock;
+		if (lock != held) {
+			if (held)
+				spin_unlock(held);
+			spin_lock(lock);
+		}
 		return &zone->lruvec;
+	}
 
 	pc = lookup_page_cgroup(page);
-	memcg = pc->mem_cgroup;
+	for (;;) {
+		memcg = ACCESS_ONCE(pc->mem_cgroup);
+		lock = mem_cgroup_lru_lock(zone, memcg);
+		if (lock != held) {
+			if (held)
+				spin_unlock(held);
+			spin_lock(lock);
+			held = lock;
+			if (memcg != ACCESS_ONCE(pc->mem_cgroup))
+				continue;
+		}
 
-	/*
-	 * Surreptitiously switch any uncharged offlist page to root:
-	 * an uncharged page off lru does nothing to secure
-	 * its former mem_cgroup from sudden removal.
-	 *
-	 * Our caller holds lru_lock, and PageCgroupUsed is updated
-	 * under page_cgroup lock: between them, they make all uses
-	 * of pc->mem_cgroup safe.
-	 */
-	if (!PageLRU(page) && !PageCgroupUsed(pc) && memcg != root_mem_cgroup)
-		pc->mem_cgroup = memcg = root_mem_cgroup;
+		/*
+		 * Surreptitiously switch any uncharged offlist page to root:
+		 * an uncharged page off lru does nothing to secure
+		 * its former mem_cgroup from sudden removal.
+		 *
+		 * We hold the lru lock of the old memcg, and PageCgroupUsed
+		 * is updated under page_cgroup lock: between them, they make
+		 * all uses of pc->mem_cgroup safe.
+		 */
+		if (!PageLRU(page) && !PageCgroupUsed(pc) &&
+		    memcg != root_mem_cgroup) {
+			pc->mem_cgroup = root_mem_cgroup;
+			continue;
+		}
 
-	mz = page_cgroup_zoneinfo(memcg, page);
-	return &mz->lruvec;
+		return &page_cgroup_zoneinfo(memcg, page)->lruvec;
+	}
+}
+
+/**
+ * mem_cgroup_page_in_lruvec - check that a page belongs to a lruvec
+ * @page: the page
+ * @lruvec: the lruvec
+ *
+ * Only stable while the lru lock of @lruvec is held, and for a THP,
+ * also its compound_lock.  pc->mem_cgroup is compared, never followed:
+ * it is NULL for a page that was never charged, and may name a memcg
+ * already freed for one that was uncharged, so this is also safe as an
+ * unlocked hint.
+ */
+bool mem_cgroup_page_in_lruvec(struct page *page, struct lruvec *lruvec)
+{
+	struct mem_cgroup *memcg;
+
+	if (page_zone(page) != lruvec_zone(lruvec))
+		return false;
+	if (mem_cgroup_disabled())
+		return lruvec == &page_zone(page)->lruvec;
+
+	memcg = ACCESS_ONCE(lookup_page_cgroup(page)->mem_cgroup);
+	return memcg && memcg == lruvec_memcg(lruvec);
+}
+
+/**
+ * lruvec_memcg - the memcg a lruvec belongs to
+ * @lruvec: the lruvec
+ *
+ * Returns NULL for the lruvec of a zone when the memcg is disabled.
+ */
+struct mem_cgroup *lruvec_memcg(struct lruvec *lruvec)
+{
+	if (mem_cgroup_disabled())
+		return NULL;
+	return container_of(lruvec, struct mem_cgroup_per_zone, lruvec)->memcg;
 }
 
 /**
@@ -2535,8 +2621,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 				       bool lrucare)
 {
 	struct page_cgroup *pc = lookup_page_cgroup(page);
-	struct zone *uninitialized_var(zone);
-	struct lruvec *lruvec;
+	struct lruvec *uninitialized_var(lruvec);
 	bool was_on_lru = false;
 	bool anon;
 
@@ -2550,12 +2635,14 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 	/*
 	 * In some cases, SwapCache and FUSE(splice_buf->radixtree), the page
 	 * may already be on some other mem_cgroup's LRU.  Take care of it.
+	 * pc->mem_cgroup selects the lru lock of such a page, so it may only
+	 * change under the lock it currently selects.  Without lrucare the
+	 * page is not on an LRU, nor on a pagevec on its way there, and
+	 * nobody looks up its lru lock before it is added after the charge.
 	 */
 	if (lrucare) {
-		zone = page_zone(page);
-		spin_lock_irq(&zone->lru_lock);
+		lruvec = lock_page_lruvec_irq(page);
 		if (PageLRU(page)) {
-			lruvec = mem_cgroup_zone_lruvec(zone, pc->mem_cgroup);
 			ClearPageLRU(page);
 			del_page_from_lru_list(page, lruvec, page_lru(page));
 			was_on_lru = true;
@@ -2575,12 +2662,12 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 
 	if (lrucare) {
 		if (was_on_lru) {
-			lruvec = mem_cgroup_zone_lruvec(zone, pc->mem_cgroup);
+			lruvec = relock_page_lruvec_irq(page, lruvec);
 			VM_BUG_ON(PageLRU(page));
 			SetPageLRU(page);
 			add_page_to_lru_list(page, lruvec, page_lru(page));
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		unlock_lruvec_irq(lruvec);
 	}
 
 	if (ctype == MEM_CGROUP_CHARGE_TYPE_ANON)
@@ -2604,7 +2691,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
 #define PCGF_NOCOPY_AT_SPLIT (1 << PCG_LOCK | 1 << PCG_MIGRATION)
 /*
  * Because tail pages are not marked as "used", set it. We're under
- * zone->lru_lock, 'splitting on pmd' and compound_lock.
+ * the lru lock of the head page, 'splitting on pmd' and compound_lock.
  * charge/uncharge will be never happen and move_account() is done under
  * compound_lock(), so we don't have to take care of races.
  */
@@ -2646,6 +2733,7 @@ static int mem_cgroup_move_account(struct page *page,
 				   struct mem_cgroup *from,
 				   struct mem_cgroup *to)
 {
+	struct lruvec *lruvec;
 	unsigned long flags;
 	int ret;
 	bool anon = PageAnon(page);
@@ -2679,8 +2767,23 @@ static int mem_cgroup_move_account(struct page *page,
 	}
 	mem_cgroup_charge_statistics(from, anon, -nr_pages);
 
-	/* caller should have done css_get */
-	pc->mem_cgroup = to;
+	/*
+	 * caller should have done css_get.
+	 *
+	 * A THP is moved under its compound_lock, or the pmd lock of its
+	 * mapping, which __split_huge_page_refcount() takes inside the lru
+	 * lock: taking the lru lock here would invert that order.  The page
+	 * is off the LRU, and the split revalidates its lruvec once it holds
+	 * the compound_lock, so pc->mem_cgroup of a THP may change without.
+	 */
+	if (nr_pages > 1) {
+		pc->mem_cgroup = to;
+	} else {
+		lruvec = mem_cgroup_zone_lruvec(page_zone(page), from);
+		spin_lock(lruvec->lru_lock);
+		pc->mem_cgroup = to;
+		spin_unlock(lruvec->lru_lock);
+	}
 	mem_cgroup_charge_statistics(to, anon, nr_pages);
 	/*
 	 * We charges against "to" which may not have any tasks. Then, "to"
@@ -3698,12 +3801,14 @@ static bool mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
 	unsigned long flags, loop;
 	struct list_head *list;
 	struct page *busy;
-	struct zone *zone;
 
-	zone = &NODE_DATA(node)->node_zones[zid];
 	mz = mem_cgroup_zoneinfo(memcg, node, zid);
 	list = &mz->lruvec.lists[lru];
 
+	/* pages on the multi-gen LRU are not found on the lru lists */
+	if (lru != LRU_UNEVICTABLE)
+		lru_gen_convert_lruvec(&mz->lruvec, false);
+
 	loop = mz->lru_size[lru];
 	/* give some margin against EBUSY etc...*/
 	loop += 256;
@@ -3712,19 +3817,19 @@ static bool mem_cgroup_force_empty_list(struct mem_cgroup *memcg,
 		struct page_cgroup *pc;
 		struct page *page;
 
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(mz->lruvec.lru_lock, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(mz->lruvec.lru_lock, flags);
 			break;
 		}
 		page = list_entry(list->prev, struct page, lru);
 		if (busy == page) {
 			list_move(&page->lru, list);
 			busy = NULL;
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(mz->lruvec.lru_lock, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(mz->lruvec.lru_lock, flags);
 
 		pc = lookup_page_cgroup(page);
 
@@ -4743,6 +4848,7 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *memcg, int node)
 	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
 		mz = &pn->zoneinfo[zone];
 		lruvec_init(&mz->lruvec, &NODE_DATA(node)->node_zones[zone]);
+		mz->lruvec.lru_lock = mem_cgroup_lru_lock(mz->lruvec.zone, memcg);
 		mz->usage_in_excess = 0;
 		mz->on_tree = false;
 		mz->memcg = memcg;
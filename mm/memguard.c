@@ -0,0 +1,539 @@
+/*
+ * mm/memguard.c
+ *
+ * Memory bandwidth regulation per CPU, the temporal counterpart of the
+ * cache and bank partitioning done by PALLOC. Each regulated CPU gets a
+ * budget of memory accesses per period. A perf event counts them and,
+ * once the budget is spent, the CPU is throttled: a SCHED_FIFO thread
+ * of the highest priority spins on it without touching memory until the
+ * period timer replenishes the budget.
+ *
+ * Memory accesses are approximated by last level cache misses where the
+ * PMU counts them, and by page faults (a software event) where it does
+ * not, e.g. in a VM without a virtual PMU. The event overflows every
+ * 1/MEMGUARD_SLICES of the budget, so a CPU overshoots its budget by at
+ * most that much before it is throttled.
+ *
+ * Controlled from debugfs/memguard:
+ *
+ *   enable	1 starts regulating the online CPUs, 0 stops
+ *   event	auto, llc or fault: the event to count, auto picks llc if
+ *		the PMU has it and fault otherwise
+ *   period_us	replenishment period in microseconds
+ *   budget	events per period and CPU, 0 for unlimited. Writing
+ *		"<budget>" sets all CPUs, "<cpu> <budget>" a single one
+ *   stat	per CPU: the event counted, its budget, the events in the
+ *		last period, how often and how long it was throttled
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/irq_work.h>
+#include <linux/perf_event.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+
+/* overflows per budget */
+#define MEMGUARD_SLICES		8
+
+#define MEMGUARD_MIN_PERIOD_US	100
+
+enum {
+	MEMGUARD_EVENT_AUTO,
+	MEMGUARD_EVENT_LLC,
+	MEMGUARD_EVENT_FAULT,
+	NR_MEMGUARD_EVENTS,
+};
+
+static const char * const memguard_event_names[NR_MEMGUARD_EVENTS] = {
+	"auto", "llc", "fault",
+};
+
+struct memguard_cpu {
+	struct perf_event *event;	/* NULL: not regulated */
+	struct task_struct *throttle;	/* spins while throttled */
+	struct hrtimer timer;		/* replenishes the budget */
+	struct irq_work wake;		/* wakes throttle from the overflow */
+	u64 budget;			/* events per period, 0: unlimited */
+	u64 period_start;		/* event count when the period began */
+	u64 used;			/* events in the last period */
+	int throttled;
+	int sw;				/* counting page faults */
+	u64 nr_throttled;
+	u64 throttle_ns;
+};
+
+static DEFINE_PER_CPU(struct memguard_cpu, memguard_cpu);
+
+/* serializes the settings below against starting and stopping */
+static DEFINE_MUTEX(memguard_mutex);
+static int memguard_enabled;
+static int memguard_event = MEMGUARD_EVENT_AUTO;
+static u32 memguard_period_us = 1000;
+
+static inline ktime_t memguard_period(void)
+{
+	return ns_to_ktime((u64)ACCESS_ONCE(memguard_period_us) *
+			   NSEC_PER_USEC);
+}
+
+/*
+ * Called in NMI context for hardware events, from the counted fault for
+ * the software one, on the CPU the event counts on.
+ */
+static void memguard_overflow(struct perf_event *event,
+			      struct perf_sample_data *data,
+			      struct pt_regs *regs)
+{
+	struct memguard_cpu *mc = event->overflow_handler_context;
+
+	/* regulating is our job, keep perf from throttling the event */
+	event->hw.interrupts = 0;
+
+	if (mc->throttled ||
+	    local64_read(&event->count) - mc->period_start < mc->budget)
+		return;
+
+	mc->throttled = 1;
+	mc->nr_throttled++;
+	irq_work_queue(&mc->wake);
+}
+
+static void memguard_wake(struct irq_work *work)
+{
+	struct memguard_cpu *mc = container_of(work, struct memguard_cpu,
+					       wake);
+
+	wake_up_process(mc->throttle);
+}
+
+static enum hrtimer_restart memguard_timer_fn(struct hrtimer *timer)
+{
+	struct memguard_cpu *mc = container_of(timer, struct memguard_cpu,
+					       timer);
+	struct perf_event *event = mc->event;
+	u64 count;
+
+	if (event->state == PERF_EVENT_STATE_ACTIVE)
+		event->pmu->read(event);
+	count = local64_read(&event->count);
+	mc->used = count - mc->period_start;
+	mc->period_start = count;
+	ACCESS_ONCE(mc->throttled) = 0;
+
+	hrtimer_forward_now(timer, memguard_period());
+	return HRTIMER_RESTART;
+}
+
+static int memguard_throttle_fn(void *data)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	struct memguard_cpu *mc = data;
+	u64 start;
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!ACCESS_ONCE(mc->throttled)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		/* keep the CPU to ourselves, without memory accesses */
+		start = local_clock();
+		while (ACCESS_ONCE(mc->throttled) && !kthread_should_stop())
+			cpu_relax();
+		mc->throttle_ns += local_clock() - start;
+	}
+	return 0;
+}
+
+static void memguard_start_timer(void *data)
+{
+	struct memguard_cpu *mc = data;
+
+	hrtimer_start(&mc->timer, memguard_period(), HRTIMER_MODE_REL_PINNED);
+}
+
+static struct perf_event *memguard_create_event(struct memguard_cpu *mc,
+						int cpu, u32 type, u64 config)
+{
+	struct perf_event_attr attr = {
+		.type		= type,
+		.config		= config,
+		.size		= sizeof(struct perf_event_attr),
+		.pinned		= 1,
+	};
+
+	attr.sample_period = max_t(u64, div64_u64(mc->budget,
+						  MEMGUARD_SLICES), 1);
+	return perf_event_create_kernel_counter(&attr, cpu, NULL,
+						memguard_overflow, mc);
+}
+
+static int memguard_start_cpu(int cpu)
+{
+	struct memguard_cpu *mc = &per_cpu(memguard_cpu, cpu);
+	struct perf_event *event = ERR_PTR(-ENOENT);
+	struct task_struct *tsk;
+
+	if (mc->event || !mc->budget)
+		return 0;
+
+	/* the overflow handler wakes it, so it has to be there first */
+	tsk = kthread_create_on_node(memguard_throttle_fn, mc,
+				     cpu_to_node(cpu), "memguard/%d", cpu);
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	kthread_bind(tsk, cpu);
+	mc->throttle = tsk;
+	mc->throttled = 0;
+	mc->period_start = 0;
+	mc->used = 0;
+
+	if (memguard_event != MEMGUARD_EVENT_FAULT) {
+		event = memguard_create_event(mc, cpu, PERF_TYPE_HARDWARE,
+					      PERF_COUNT_HW_CACHE_MISSES);
+		mc->sw = 0;
+	}
+	if (IS_ERR(event) && memguard_event != MEMGUARD_EVENT_LLC) {
+		event = memguard_create_event(mc, cpu, PERF_TYPE_SOFTWARE,
+					      PERF_COUNT_SW_PAGE_FAULTS);
+		mc->sw = 1;
+	}
+	if (IS_ERR(event)) {
+		kthread_stop(tsk);
+		mc->throttle = NULL;
+		return PTR_ERR(event);
+	}
+	mc->event = event;
+	wake_up_process(tsk);
+	smp_call_function_single(cpu, memguard_start_timer, mc, 1);
+	return 0;
+}
+
+static void memguard_stop_cpu(int cpu)
+{
+	struct memguard_cpu *mc = &per_cpu(memguard_cpu, cpu);
+
+	if (!mc->event)
+		return;
+
+	/*
+	 * No overflow may throttle the CPU once its timer is gone, that
+	 * could be the CPU we are running on.
+	 */
+	perf_event_disable(mc->event);
+	hrtimer_cancel(&mc->timer);
+	irq_work_sync(&mc->wake);
+	ACCESS_ONCE(mc->throttled) = 0;
+	kthread_stop(mc->throttle);
+	perf_event_release_kernel(mc->event);
+	mc->event = NULL;
+	mc->throttle = NULL;
+}
+
+/* called with memguard_mutex and the online CPUs held */
+static void memguard_stop(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		memguard_stop_cpu(cpu);
+}
+
+static int memguard_start(void)
+{
+	int cpu, ret;
+
+	for_each_online_cpu(cpu) {
+		ret = memguard_start_cpu(cpu);
+		if (ret) {
+			pr_warn("memguard: cannot regulate cpu%d: %d\n",
+				cpu, ret);
+			memguard_stop();
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* apply changed settings to the CPUs being regulated */
+static int memguard_restart(void)
+{
+	if (!memguard_enabled)
+		return 0;
+	memguard_stop();
+	return memguard_start();
+}
+
+static int __cpuinit memguard_cpu_callback(struct notifier_block *nb,
+					   unsigned long action, void *hcpu)
+{
+	int cpu = (long)hcpu;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_ONLINE:
+	case CPU_DOWN_FAILED:
+		mutex_lock(&memguard_mutex);
+		if (memguard_enabled)
+			memguard_start_cpu(cpu);
+		mutex_unlock(&memguard_mutex);
+		break;
+	case CPU_DOWN_PREPARE:
+		mutex_lock(&memguard_mutex);
+		memguard_stop_cpu(cpu);
+		mutex_unlock(&memguard_mutex);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int memguard_enable_get(void *data, u64 *val)
+{
+	*val = memguard_enabled;
+	return 0;
+}
+
+static int memguard_enable_set(void *data, u64 val)
+{
+	int cpu, ret = 0;
+
+	/* the CPU notifier takes memguard_mutex under the hotplug lock */
+	get_online_cpus();
+	mutex_lock(&memguard_mutex);
+	if (val && !memguard_enabled) {
+		for_each_possible_cpu(cpu) {
+			per_cpu(memguard_cpu, cpu).nr_throttled = 0;
+			per_cpu(memguard_cpu, cpu).throttle_ns = 0;
+		}
+		ret = memguard_start();
+		memguard_enabled = !ret;
+	} else if (!val && memguard_enabled) {
+		memguard_stop();
+		memguard_enabled = 0;
+	}
+	mutex_unlock(&memguard_mutex);
+	put_online_cpus();
+	return ret;
+}
+DEFINE_SIMPLE_ATTRIBUTE(memguard_enable_fops, memguard_enable_get,
+			memguard_enable_set, "%llu\n");
+
+static int memguard_period_get(void *data, u64 *val)
+{
+	*val = memguard_period_us;
+	return 0;
+}
+
+static int memguard_period_set(void *data, u64 val)
+{
+	if (val < MEMGUARD_MIN_PERIOD_US || val > USEC_PER_SEC)
+		return -EINVAL;
+	/* picked up by the timers when they next fire */
+	ACCESS_ONCE(memguard_period_us) = val;
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(memguard_period_fops, memguard_period_get,
+			memguard_period_set, "%llu\n");
+
+static int memguard_event_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < NR_MEMGUARD_EVENTS; i++)
+		seq_printf(m, i == memguard_event ? "[%s] " : "%s ",
+			   memguard_event_names[i]);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int memguard_event_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, memguard_event_show, NULL);
+}
+
+static ssize_t memguard_event_write(struct file *filp,
+				    const char __user *ubuf,
+				    size_t cnt, loff_t *ppos)
+{
+	char buf[16];
+	int i, ret;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = '\0';
+
+	for (i = 0; i < NR_MEMGUARD_EVENTS; i++)
+		if (!strcmp(strim(buf), memguard_event_names[i]))
+			break;
+	if (i == NR_MEMGUARD_EVENTS)
+		return -EINVAL;
+
+	get_online_cpus();
+	mutex_lock(&memguard_mutex);
+	memguard_event = i;
+	ret = memguard_restart();
+	mutex_unlock(&memguard_mutex);
+	put_online_cpus();
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+	return cnt;
+}
+
+static const struct file_operations memguard_event_fops = {
+	.open		= memguard_event_open,
+	.write		= memguard_event_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int memguard_budget_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		seq_printf(m, "%d %llu\n", cpu,
+			   per_cpu(memguard_cpu, cpu).budget);
+	return 0;
+}
+
+static int memguard_budget_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, memguard_budget_show, NULL);
+}
+
+static ssize_t memguard_budget_write(struct file *filp,
+				     const char __user *ubuf,
+				     size_t cnt, loff_t *ppos)
+{
+	unsigned long long budget;
+	char buf[64];
+	int cpu, ret;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = '\0';
+
+	ret = sscanf(buf, "%d %llu", &cpu, &budget);
+	if (ret == 1) {
+		if (kstrtoull(strim(buf), 0, &budget))
+			return -EINVAL;
+		cpu = -1;
+	} else if (ret != 2 || cpu < 0 || cpu >= nr_cpu_ids ||
+		   !cpu_possible(cpu)) {
+		return -EINVAL;
+	}
+
+	get_online_cpus();
+	mutex_lock(&memguard_mutex);
+	if (cpu < 0) {
+		for_each_possible_cpu(cpu)
+			per_cpu(memguard_cpu, cpu).budget = budget;
+	} else {
+		per_cpu(memguard_cpu, cpu).budget = budget;
+	}
+	/* the sample period of the events depends on the budget */
+	ret = memguard_restart();
+	mutex_unlock(&memguard_mutex);
+	put_online_cpus();
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+	return cnt;
+}
+
+static const struct file_operations memguard_budget_fops = {
+	.open		= memguard_budget_open,
+	.write		= memguard_budget_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int memguard_stat_show(struct seq_file *m, void *v)
+{
+	struct memguard_cpu *mc;
+	int cpu;
+
+	seq_printf(m, "%-5s %-6s %12s %12s %10s %14s\n", "cpu", "event",
+		   "budget", "used", "throttled", "throttle_us");
+	mutex_lock(&memguard_mutex);
+	for_each_online_cpu(cpu) {
+		mc = &per_cpu(memguard_cpu, cpu);
+		seq_printf(m, "%-5d %-6s %12llu %12llu %10llu %14llu\n", cpu,
+			   !mc->event ? "-" : mc->sw ? "fault" : "llc",
+			   mc->budget, mc->used, mc->nr_throttled,
+			   div_u64(mc->throttle_ns, NSEC_PER_USEC));
+	}
+	mutex_unlock(&memguard_mutex);
+	return 0;
+}
+
+static int memguard_stat_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, memguard_stat_show, NULL);
+}
+
+static const struct file_operations memguard_stat_fops = {
+	.open		= memguard_stat_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init memguard_init(void)
+{
+	umode_t mode = S_IFREG | S_IRUSR | S_IWUSR;
+	struct memguard_cpu *mc;
+	struct dentry *dir;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		mc = &per_cpu(memguard_cpu, cpu);
+		hrtimer_init(&mc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		mc->timer.function = memguard_timer_fn;
+		init_irq_work(&mc->wake, memguard_wake);
+	}
+	hotcpu_notifier(memguard_cpu_callback, 0);
+
+	dir = debugfs_create_dir("memguard", NULL);
+	if (!dir)
+		return -ENOMEM;
+	if (!debugfs_create_file("enable", mode, dir, NULL,
+				 &memguard_enable_fops))
+		goto fail;
+	if (!debugfs_create_file("event", mode, dir, NULL,
+				 &memguard_event_fops))
+		goto fail;
+	if (!debugfs_create_file("period_us", mode, dir, NULL,
+				 &memguard_period_fops))
+		goto fail;
+	if (!debugfs_create_file("budget", mode, dir, NULL,
+				 &memguard_budget_fops))
+		goto fail;
+	if (!debugfs_create_file("stat", S_IFREG | S_IRUSR, dir, NULL,
+				 &memguard_stat_fops))
+		goto fail;
+	return 0;
+fail:
+	debugfs_remove_recursive(dir);
+	return -ENOMEM;
+}
+late_initcall(memguard_init);
@@ -90,6 +90,7 @@
 #include <linux/syscalls.h>
 #include <linux/ctype.h>
 #include <linux/mm_inline.h>
+#include <linux/palloc.h>
 
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
@@ -195,6 +196,75 @@ static int mpol_new_bind(struct mempolicy *pol, const nodemask_t *nodes)
 	return 0;
 }
 
+/*
+ * MPOL_COLOR allocates on the local node. The colors are set by
+ * mpol_set_colors(), the node mask passed is empty.
+ */
+static int mpol_new_color(struct mempolicy *pol, const nodemask_t *nodes)
+{
+	pol->flags |= MPOL_F_LOCAL;
+	return 0;
+}
+
+#ifdef CONFIG_CGROUP_PALLOC
+/* bits of the color mask passed to mbind() and set_mempolicy() */
+#define MPOL_COLOR_BITS	MAX_PALLOC_BINS
+
+static void mpol_set_colors(struct mempolicy *pol, const unsigned long *colors)
+{
+	if (pol && pol->mode == MPOL_COLOR)
+		bitmap_copy(pol->v.colors, colors, MAX_PALLOC_BINS);
+}
+
+static void get_policy_colors(struct mempolicy *p, unsigned long *colors)
+{
+	bitmap_zero(colors, MAX_PALLOC_BINS);
+	if (p->mode == MPOL_COLOR)
+		bitmap_copy(colors, p->v.colors, MAX_PALLOC_BINS);
+}
+
+/*
+ * Have the allocation in progress take pages of the colors of pol,
+ * within the bins of the task's palloc group. Returns what to pass to
+ * mpol_restore_colors() once it is done.
+ */
+static inline const unsigned long *mpol_use_colors(struct mempolicy *pol)
+{
+	const unsigned long *old = current->palloc_colors;
+
+	if (unlikely(pol->mode == MPOL_COLOR))
+		current->palloc_colors = pol->v.colors;
+	return old;
+}
+
+static inline void mpol_restore_colors(const unsigned long *old)
+{
+	current->palloc_colors = old;
+}
+#else
+#define MPOL_COLOR_BITS	1
+
+static inline void mpol_set_colors(struct mempolicy *pol,
+				   const unsigned long *colors)
+{
+}
+
+static inline void get_policy_colors(struct mempolicy *p,
+				     unsigned long *colors)
+{
+	bitmap_zero(colors, MPOL_COLOR_BITS);
+}
+
+static inline const unsigned long *mpol_use_colors(struct mempolicy *pol)
+{
+	return NULL;
+}
+
+static inline void mpol_restore_colors(const unsigned long *old)
+{
+}
+#endif
+
 /*
  * mpol_set_nodemask is called after mpol_new() to set up the nodemask, if
  * any, for the new policy.  mpol_new() has already validated the nodes
@@ -269,6 +339,10 @@ static struct mempolicy *mpol_new(unsigned short mode, unsigned short flags,
 			     (flags & MPOL_F_RELATIVE_NODES)))
 				return ERR_PTR(-EINVAL);
 		}
+	} else if (mode == MPOL_COLOR) {
+		/* no nodes to be static or relative about */
+		if (flags & MPOL_MODE_FLAGS)
+			return ERR_PTR(-EINVAL);
 	} else if (nodes_empty(*nodes))
 		return ERR_PTR(-EINVAL);
 	policy = kmem_cache_alloc(policy_cache, GFP_KERNEL);
@@ -455,6 +529,10 @@ static const struct mempolicy_operations mpol_ops[MPOL_MAX] = {
 		.create = mpol_new_bind,
 		.rebind = mpol_rebind_nodemask,
 	},
+	[MPOL_COLOR] = {
+		.create = mpol_new_color,
+		.rebind = mpol_rebind_default,
+	},
 };
 
 static void migrate_page_add(struct page *page, struct list_head *pagelist,
@@ -710,7 +788,7 @@ static void mpol_set_task_struct_flag(void)
 
 /* Set the process memory policy */
 static long do_set_mempolicy(unsigned short mode, unsigned short flags,
-			     nodemask_t *nodes)
+			     nodemask_t *nodes, const unsigned long *colors)
 {
 	struct mempolicy *new, *old;
 	struct mm_struct *mm = current->mm;
@@ -725,6 +803,7 @@ static long do_set_mempolicy(unsigned short mode, unsigned short flags,
 		ret = PTR_ERR(new);
 		goto out;
 	}
+	mpol_set_colors(new, colors);
 	/*
 	 * prevent changing our mempolicy while show_numa_maps()
 	 * is using it.
@@ -781,6 +860,9 @@ static void get_policy_nodemask(struct mempolicy *p, nodemask_t *nodes)
 			node_set(p->v.preferred_node, *nodes);
 		/* else return empty node mask for local allocation */
 		break;
+	case MPOL_COLOR:
+		/* local allocation, see get_policy_colors() */
+		break;
 	default:
 		BUG();
 	}
@@ -801,7 +883,8 @@ static int lookup_node(struct mm_struct *mm, unsigned long addr)
 
 /* Retrieve NUMA policy */
 static long do_get_mempolicy(int *policy, nodemask_t *nmask,
-			     unsigned long addr, unsigned long flags)
+			     unsigned long *colors, unsigned long addr,
+			     unsigned long flags)
 {
 	int err;
 	struct mm_struct *mm = current->mm;
@@ -879,6 +962,7 @@ static long do_get_mempolicy(int *policy, nodemask_t *nmask,
 		} else {
 			task_lock(current);
 			get_policy_nodemask(pol, nmask);
+			get_policy_colors(pol, colors);
 			task_unlock(current);
 		}
 	}
@@ -1099,7 +1183,8 @@ static struct page *new_vma_page(struct page *page, unsigned long private, int *
 
 static long do_mbind(unsigned long start, unsigned long len,
 		     unsigned short mode, unsigned short mode_flags,
-		     nodemask_t *nmask, unsigned long flags)
+		     nodemask_t *nmask, const unsigned long *colors,
+		     unsigned long flags)
 {
 	struct vm_area_struct *vma;
 	struct mm_struct *mm = current->mm;
@@ -1113,6 +1198,9 @@ static long do_mbind(unsigned long start, unsigned long len,
 		return -EINVAL;
 	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
 		return -EPERM;
+	/* the pages in place are recolored by palloc.migrate, not here */
+	if (mode == MPOL_COLOR && flags)
+		return -EINVAL;
 
 	if (start & ~PAGE_MASK)
 		return -EINVAL;
@@ -1131,6 +1219,7 @@ static long do_mbind(unsigned long start, unsigned long len,
 	new = mpol_new(mode, mode_flags, nmask);
 	if (IS_ERR(new))
 		return PTR_ERR(new);
+	mpol_set_colors(new, colors);
 
 	/*
 	 * If we are using the default policy then operation
@@ -1260,11 +1349,57 @@ static int copy_nodes_to_user(unsigned long __user *mask, unsigned long maxnode,
 	return copy_to_user(mask, nodes_addr(*nodes), copy) ? -EFAULT : 0;
 }
 
+/*
+ * Copy a color mask from user space. MPOL_COLOR passes it in place of
+ * the node mask, maxnode giving the number of colors plus one.
+ */
+static int get_colors(unsigned long *colors, const unsigned long __user *nmask,
+		      unsigned long maxnode)
+{
+#ifdef CONFIG_CGROUP_PALLOC
+	unsigned long nlongs;
+
+	--maxnode;
+	bitmap_zero(colors, MPOL_COLOR_BITS);
+	if (maxnode == 0 || !nmask || maxnode > MPOL_COLOR_BITS)
+		return -EINVAL;
+	nlongs = BITS_TO_LONGS(maxnode);
+	if (copy_from_user(colors, nmask, nlongs * sizeof(unsigned long)))
+		return -EFAULT;
+	if (maxnode % BITS_PER_LONG)
+		colors[nlongs - 1] &= (1UL << (maxnode % BITS_PER_LONG)) - 1;
+	/* at least one of the colors must exist */
+	if (find_first_bit(colors, MPOL_COLOR_BITS) >= palloc_bins())
+		return -EINVAL;
+	return 0;
+#else
+	return -EINVAL;
+#endif
+}
+
+/* Copy a kernel color mask to user space */
+static int copy_colors_to_user(unsigned long __user *mask,
+			       unsigned long maxnode, unsigned long *colors)
+{
+	unsigned long copy = ALIGN(maxnode-1, 64) / 8;
+	const int nbytes = BITS_TO_LONGS(MPOL_COLOR_BITS) * sizeof(long);
+
+	if (copy > nbytes) {
+		if (copy > PAGE_SIZE)
+			return -EINVAL;
+		if (clear_user((char __user *)mask + nbytes, copy - nbytes))
+			return -EFAULT;
+		copy = nbytes;
+	}
+	return copy_to_user(mask, colors, copy) ? -EFAULT : 0;
+}
+
 SYSCALL_DEFINE6(mbind, unsigned long, start, unsigned long, len,
 		unsigned long, mode, unsigned long __user *, nmask,
 		unsigned long, maxnode, unsigned, flags)
 {
 	nodemask_t nodes;
+	DECLARE_BITMAP(colors, MPOL_COLOR_BITS);
 	int err;
 	unsigned short mode_flags;
 
@@ -1275,10 +1410,14 @@ SYSCALL_DEFINE6(mbind, unsigned long, start, unsigned long, len,
 	if ((mode_flags & MPOL_F_STATIC_NODES) &&
 	    (mode_flags & MPOL_F_RELATIVE_NODES))
 		return -EINVAL;
-	err = get_nodes(&nodes, nmask, maxnode);
+	if (mode == MPOL_COLOR) {
+		nodes_clear(nodes);
+		err = get_colors(colors, nmask, maxnode);
+	} else
+		err = get_nodes(&nodes, nmask, maxnode);
 	if (err)
 		return err;
-	return do_mbind(start, len, mode, mode_flags, &nodes, flags);
+	return do_mbind(start, len, mode, mode_flags, &nodes, colors, flags);
 }
 
 /* Set the process memory policy */
@@ -1287,6 +1426,7 @@ SYSCALL_DEFINE3(set_mempolicy, int, mode, unsigned long __user *, nmask,
 {
 	int err;
 	nodemask_t nodes;
+	DECLARE_BITMAP(colors, MPOL_COLOR_BITS);
 	unsigned short flags;
 
 	flags = mode & MPOL_MODE_FLAGS;
@@ -1295,10 +1435,14 @@ SYSCALL_DEFINE3(set_mempolicy, int, mode, unsigned long __user *, nmask,
 		return -EINVAL;
 	if ((flags & MPOL_F_STATIC_NODES) && (flags & MPOL_F_RELATIVE_NODES))
 		return -EINVAL;
-	err = get_nodes(&nodes, nmask, maxnode);
+	if (mode == MPOL_COLOR) {
+		nodes_clear(nodes);
+		err = get_colors(colors, nmask, maxnode);
+	} else
+		err = get_nodes(&nodes, nmask, maxnode);
 	if (err)
 		return err;
-	return do_set_mempolicy(mode, flags, &nodes);
+	return do_set_mempolicy(mode, flags, &nodes, colors);
 }
 
 SYSCALL_DEFINE4(migrate_pages, pid_t, pid, unsigned long, maxnode,
@@ -1404,11 +1548,13 @@ SYSCALL_DEFINE5(get_mempolicy, int __user *, policy,
 	int err;
 	int uninitialized_var(pval);
 	nodemask_t nodes;
+	DECLARE_BITMAP(colors, MPOL_COLOR_BITS);
 
 	if (nmask != NULL && maxnode < MAX_NUMNODES)
 		return -EINVAL;
 
-	err = do_get_mempolicy(&pval, &nodes, addr, flags);
+	bitmap_zero(colors, MPOL_COLOR_BITS);
+	err = do_get_mempolicy(&pval, &nodes, colors, addr, flags);
 
 	if (err)
 		return err;
@@ -1416,7 +1562,10 @@ SYSCALL_DEFINE5(get_mempolicy, int __user *, policy,
 	if (policy && put_user(pval, policy))
 		return -EFAULT;
 
-	if (nmask)
+	/* MPOL_COLOR returns its colors in place of the nodes */
+	if (nmask && !bitmap_empty(colors, MPOL_COLOR_BITS))
+		err = copy_colors_to_user(nmask, maxnode, colors);
+	else if (nmask)
 		err = copy_nodes_to_user(nmask, maxnode, &nodes);
 
 	return err;
@@ -1573,6 +1722,8 @@ static struct zonelist *policy_zonelist(gfp_t gfp, struct mempolicy *policy,
 				unlikely(!node_isset(nd, policy->v.nodes)))
 			nd = first_node(policy->v.nodes);
 		break;
+	case MPOL_COLOR:
+		break;
 	default:
 		BUG();
 	}
@@ -1764,6 +1915,7 @@ bool init_nodemask_of_mempolicy(nodemask_t *mask)
 	mempolicy = current->mempolicy;
 	switch (mempolicy->mode) {
 	case MPOL_PREFERRED:
+	case MPOL_COLOR:
 		if (mempolicy->flags & MPOL_F_LOCAL)
 			nid = numa_node_id();
 		else
@@ -1818,6 +1970,8 @@ bool mempolicy_nodemask_intersects(struct task_struct *tsk,
 		 * nodes in mask.
 		 */
 		break;
+	case MPOL_COLOR:
+		break;
 	case MPOL_BIND:
 	case MPOL_INTERLEAVE:
 		ret = nodes_intersects(mempolicy->v.nodes, *mask);
@@ -1876,6 +2030,7 @@ alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 	struct zonelist *zl;
 	struct page *page;
 	unsigned int cpuset_mems_cookie;
+	const unsigned long *colors;
 
 retry_cpuset:
 	pol = get_vma_policy(current, vma, addr);
@@ -1897,8 +2052,12 @@ retry_cpuset:
 		/*
 		 * slow path: ref counted shared policy
 		 */
-		struct page *page =  __alloc_pages_nodemask(gfp, order,
-						zl, policy_nodemask(gfp, pol));
+		struct page *page;
+
+		colors = mpol_use_colors(pol);
+		page = __alloc_pages_nodemask(gfp, order,
+					      zl, policy_nodemask(gfp, pol));
+		mpol_restore_colors(colors);
 		__mpol_put(pol);
 		if (unlikely(!put_mems_allowed(cpuset_mems_cookie) && !page))
 			goto retry_cpuset;
@@ -1907,8 +2066,10 @@ retry_cpuset:
 	/*
 	 * fast path:  default or task policy
 	 */
+	colors = mpol_use_colors(pol);
 	page = __alloc_pages_nodemask(gfp, order, zl,
 				      policy_nodemask(gfp, pol));
+	mpol_restore_colors(colors);
 	if (unlikely(!put_mems_allowed(cpuset_mems_cookie) && !page))
 		goto retry_cpuset;
 	return page;
@@ -1938,6 +2099,7 @@ struct page *alloc_pages_current(gfp_t gfp, unsigned order)
 	struct mempolicy *pol = current->mempolicy;
 	struct page *page;
 	unsigned int cpuset_mems_cookie;
+	const unsigned long *colors;
 
 	if (!pol || in_interrupt() || (gfp & __GFP_THISNODE))
 		pol = &default_policy;
@@ -1951,10 +2113,13 @@ retry_cpuset:
 	 */
 	if (pol->mode == MPOL_INTERLEAVE)
 		page = alloc_page_interleave(gfp, order, interleave_nodes(pol));
-	else
+	else {
+		colors = mpol_use_colors(pol);
 		page = __alloc_pages_nodemask(gfp, order,
 				policy_zonelist(gfp, pol, numa_node_id()),
 				policy_nodemask(gfp, pol));
+		mpol_restore_colors(colors);
+	}
 
 	if (unlikely(!put_mems_allowed(cpuset_mems_cookie) && !page))
 		goto retry_cpuset;
@@ -2045,6 +2210,10 @@ bool __mpol_equal(struct mempolicy *a, struct mempolicy *b)
 		return !!nodes_equal(a->v.nodes, b->v.nodes);
 	case MPOL_PREFERRED:
 		return a->v.preferred_node == b->v.preferred_node;
+#ifdef CONFIG_CGROUP_PALLOC
+	case MPOL_COLOR:
+		return bitmap_equal(a->v.colors, b->v.colors, MAX_PALLOC_BINS);
+#endif
 	default:
 		BUG();
 		return false;
@@ -2338,14 +2507,14 @@ void __init numa_policy_init(void)
 	if (unlikely(nodes_empty(interleave_nodes)))
 		node_set(prefer, interleave_nodes);
 
-	if (do_set_mempolicy(MPOL_INTERLEAVE, 0, &interleave_nodes))
+	if (do_set_mempolicy(MPOL_INTERLEAVE, 0, &interleave_nodes, NULL))
 		printk("numa_policy_init: interleaving failed\n");
 }
 
 /* Reset policy of current process to default */
 void numa_default_policy(void)
 {
-	do_set_mempolicy(MPOL_DEFAULT, 0, NULL);
+	do_set_mempolicy(MPOL_DEFAULT, 0, NULL, NULL);
 }
 
 /*
@@ -2363,6 +2532,7 @@ static const char * const policy_modes[] =
 	[MPOL_PREFERRED]  = "prefer",
 	[MPOL_BIND]       = "bind",
 	[MPOL_INTERLEAVE] = "interleave",
+	[MPOL_COLOR]      = "color",
 	[MPOL_LOCAL]      = "local"
 };
 
@@ -2458,6 +2628,12 @@ int mpol_parse_str(char *str, struct mempolicy **mpol, int no_context)
 		 */
 		if (!nodelist)
 			goto out;
+		break;
+	case MPOL_COLOR:
+		/*
+		 * The nodelist would have to hold colors
+		 */
+		goto out;
 	}
 
 	mode_flags = 0;
@@ -2561,6 +2737,10 @@ int mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol, int no_context)
 			nodes = pol->v.nodes;
 		break;
 
+	case MPOL_COLOR:
+		nodes_clear(nodes);
+		break;
+
 	default:
 		return -EINVAL;
 	}
@@ -2592,5 +2772,14 @@ int mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol, int no_context)
 		*p++ = ':';
 	 	p += nodelist_scnprintf(p, buffer + maxlen - p, nodes);
 	}
+#ifdef CONFIG_CGROUP_PALLOC
+	if (mode == MPOL_COLOR) {
+		if (buffer + maxlen < p + 2)
+			return -ENOSPC;
+		*p++ = ':';
+		p += bitmap_scnlistprintf(p, buffer + maxlen - p,
+					  pol->v.colors, MAX_PALLOC_BINS);
+	}
+#endif
 	return p - buffer;
 }
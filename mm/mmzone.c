@@ -90,12 +90,25 @@ int memmap_valid_within(unsigned long pfn,
 void lruvec_init(struct lruvec *lruvec, struct zone *zone)
 {
 	enum lru_list lru;
+#ifdef CONFIG_LRU_GEN
+	int gen;
+#endif
 
 	memset(lruvec, 0, sizeof(struct lruvec));
 
 	for_each_lru(lru)
 		INIT_LIST_HEAD(&lruvec->lists[lru]);
 
+#ifdef CONFIG_LRU_GEN
+	BUILD_BUG_ON(MAX_NR_GENS + 1 > 1 << LRU_GEN_WIDTH);
+	lruvec->lrugen.max_seq = MIN_NR_GENS - 1;
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		INIT_LIST_HEAD(&lruvec->lrugen.lists[gen][0]);
+		INIT_LIST_HEAD(&lruvec->lrugen.lists[gen][1]);
+	}
+#endif
+
+	lruvec->lru_lock = &zone->lru_locks[0].lock;
 #ifdef CONFIG_MEMCG
 	lruvec->zone = zone;
 #endif
@@ -60,13 +60,17 @@
 #include <linux/migrate.h>
 #include <linux/page-debug-flags.h>
 #include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
 #include "internal.h"
 
 #ifdef CONFIG_CGROUP_PALLOC
 #include <linux/palloc.h>
+#include <trace/events/palloc.h>
 
+/* time the allocations for debugfs/palloc/control, see update_stat() */
 int memdbg_enable = 0;
 EXPORT_SYMBOL(memdbg_enable);
 
@@ -77,14 +81,233 @@ static unsigned long sysctl_palloc_mask = 0x0;
 static int mc_xor_bits[64];
 static int use_mc_xor = 0;
 static int use_palloc = 0;
+/* apply the cgroup's bins to order > 0 allocations as well */
+static u32 use_palloc_high_order = 0;
+/* color bits that select a cache color; the other bits select a bank */
+static int palloc_cache_bits = 0;
+/*
+ * Color cache rebalancer: every palloc_balance_ms, color lists of a zone
+ * that were not allocated from are trimmed to palloc_color_min pages,
+ * and all of them to palloc_color_max pages (0: no bound).
+ */
+static u32 palloc_balance_ms = 1000;
+static unsigned long palloc_balance_seq;	/* bumped on a change */
+static u32 palloc_color_min = 32;
+static u32 palloc_color_max = 0;
+/*
+ * Reclaim is not aimed at the bins, so a strict group can keep failing
+ * while plenty of memory is free. After this many rounds of reclaim, or
+ * instead of invoking the OOM killer, the allocation falls back to
+ * pages outside of the bins.
+ */
+static u32 palloc_strict_retries = 4;
 
 DEFINE_PER_CPU(long, palloc_rand_seed);
 
-#define memdbg(lvl, fmt, ...)					\
-        do {                                                    \
-		if(memdbg_enable >= lvl)			\
-			trace_printk(fmt, ##__VA_ARGS__);       \
-        } while(0)
+/*
+ * What the allocation in progress on this cpu went through, consumed by
+ * palloc_account() before interrupts are enabled again.
+ */
+struct palloc_ctx {
+	int miss;	/* the color cache had to be rebuilt */
+	int iters;	/* free blocks visited */
+	int neighbor;	/* got a color next to the group's bins */
+	int strict;	/* the strict policy refused a fallback */
+};
+static DEFINE_PER_CPU(struct palloc_ctx, palloc_ctx);
+
+/* forget what the last allocation of this cpu left in palloc_ctx */
+static inline void palloc_ctx_reset(void)
+{
+	memset(&__get_cpu_var(palloc_ctx), 0, sizeof(struct palloc_ctx));
+}
+
+/*
+ * The palloc_owner() key of the group each page was allocated for, 0 if
+ * none, so that its free is counted against the same group. Allocated the
+ * first time palloc is enabled, and NULL until then or if that failed;
+ * pfns past it, e.g. hotplugged, are not counted.
+ */
+static u32 *palloc_page_owner;
+static unsigned long palloc_nr_owner;
+
+/*
+ * The color configuration. Color bit i of a page is the parity of its
+ * physical address masked by hash[i]. By default the masks are derived
+ * from palloc_mask and the xor bits; writing the debugfs "hash" file
+ * sets them directly.
+ *
+ * A change builds a new configuration under palloc_config_mutex and
+ * publishes it with rcu_assign_pointer(), so that a lookup never sees
+ * half rebuilt tables. The allocator reads it with interrupts disabled,
+ * everyone else under rcu_read_lock_sched().
+ */
+struct palloc_colors {
+	unsigned long gen;		/* bumped for every configuration */
+	int nr_bits;
+	u64 hash[MAX_PALLOC_BITS];
+	/* color bits that vary between the pages of a block of an order */
+	int order_vmask[MAX_ORDER];
+	/*
+	 * Since the hash is linear, the color of a pfn is the color of its
+	 * pageblock xor the color of its offset in the pageblock. Both are
+	 * precomputed so that page_to_color() needs no per-bit loop; NULL
+	 * if they could not be allocated.
+	 */
+	u8 *block_color;
+	u8 *offset_color;
+};
+
+static struct palloc_colors palloc_boot_colors = { .gen = 1 };
+static struct palloc_colors __rcu *palloc_colors = &palloc_boot_colors;
+
+/* settings the configuration is built from, under palloc_config_mutex */
+static u64 palloc_custom[MAX_PALLOC_BITS];
+static int palloc_custom_bits;
+static int palloc_custom_hash;
+static DEFINE_MUTEX(palloc_config_mutex);
+static unsigned long palloc_nr_blocks;
+
+/* interrupts disabled or rcu_read_lock_sched() held */
+static inline struct palloc_colors *palloc_cfg(void)
+{
+	return rcu_dereference_sched(palloc_colors);
+}
+
+static inline int palloc_hash_color(struct palloc_colors *pc, u64 paddr)
+{
+	int i, color = 0;
+
+	for (i = 0; i < pc->nr_bits; i++)
+		color |= (hweight64(paddr & pc->hash[i]) & 1) << i;
+	return color;
+}
+
+static inline int __page_to_color(struct palloc_colors *pc,
+				  struct page *page)
+{
+	unsigned long pfn = page_to_pfn(page);
+	unsigned long idx = pfn >> pageblock_order;
+
+	if (likely(pc->block_color && idx < palloc_nr_blocks))
+		return pc->block_color[idx] ^
+			pc->offset_color[pfn & (pageblock_nr_pages - 1)];
+	return palloc_hash_color(pc, PFN_PHYS(pfn));
+}
+
+static inline int page_to_color(struct page *page)
+{
+	return __page_to_color(palloc_cfg(), page);
+}
+
+/* derive the hash from palloc_mask and the xor bits */
+static void palloc_legacy_hash(struct palloc_colors *pc)
+{
+	int c, idx = 0;
+
+	for_each_set_bit(c, &sysctl_palloc_mask, sizeof(unsigned long) * 8) {
+		if (idx >= MAX_PALLOC_BITS)
+			break;
+		pc->hash[idx] = 1ULL << c;
+		if (use_mc_xor && mc_xor_bits[c] > 0)
+			pc->hash[idx] |= 1ULL << mc_xor_bits[c];
+		idx++;
+	}
+	pc->nr_bits = idx;
+}
+
+static void palloc_build_color_tables(struct palloc_colors *pc)
+{
+	unsigned long i;
+
+	if (!palloc_nr_blocks)
+		return;
+	pc->block_color = vmalloc(palloc_nr_blocks);
+	pc->offset_color = kmalloc(pageblock_nr_pages, GFP_KERNEL);
+	if (!pc->block_color || !pc->offset_color) {
+		/* page_to_color() computes the hash on the fly */
+		vfree(pc->block_color);
+		kfree(pc->offset_color);
+		pc->block_color = NULL;
+		pc->offset_color = NULL;
+		return;
+	}
+	for (i = 0; i < palloc_nr_blocks; i++)
+		pc->block_color[i] =
+			palloc_hash_color(pc, PFN_PHYS(i << pageblock_order));
+	for (i = 0; i < pageblock_nr_pages; i++)
+		pc->offset_color[i] = palloc_hash_color(pc, PFN_PHYS(i));
+}
+
+static void palloc_flush_zone(struct zone *zone);
+
+/* give the per-cpu color lists and the color cache back to the buddy */
+static void palloc_flush_all(void)
+{
+	struct zone *zone;
+
+	drain_all_pages();
+	for_each_populated_zone(zone)
+		palloc_flush_zone(zone);
+}
+
+/*
+ * Build and publish a configuration from the current settings. The zone
+ * indexes built for the previous one are dropped under zone->lock before
+ * it is freed, and the pages cached under the old colors are flushed.
+ * palloc_config_mutex must be held; the caller rebuilds the groups' color
+ * maps with palloc_rebuild_cmaps() once it is released.
+ */
+static int palloc_config_changed(void)
+{
+	struct palloc_colors *pc, *old;
+	struct zone *zone;
+	unsigned long flags;
+	u64 low;
+	int order, i;
+
+	old = rcu_dereference_protected(palloc_colors,
+				lockdep_is_held(&palloc_config_mutex));
+	pc = kzalloc(sizeof(*pc), GFP_KERNEL);
+	if (!pc)
+		return -ENOMEM;
+	pc->gen = old->gen + 1;
+	if (palloc_custom_hash) {
+		for (i = 0; i < palloc_custom_bits; i++)
+			pc->hash[i] = palloc_custom[i];
+		pc->nr_bits = palloc_custom_bits;
+	} else {
+		palloc_legacy_hash(pc);
+	}
+	palloc_build_color_tables(pc);
+
+	/* color bits that vary between the pages of an order block */
+	for (order = 0; order < MAX_ORDER; order++) {
+		int vmask = 0;
+
+		low = ((1ULL << order) - 1) << PAGE_SHIFT;
+		for (i = 0; i < pc->nr_bits; i++) {
+			if (pc->hash[i] & low)
+				vmask |= (1<<i);
+		}
+		pc->order_vmask[order] = vmask;
+	}
+
+	rcu_assign_pointer(palloc_colors, pc);
+	for_each_populated_zone(zone) {
+		spin_lock_irqsave(&zone->lock, flags);
+		zone->color_cfg = NULL;
+		spin_unlock_irqrestore(&zone->lock, flags);
+	}
+	synchronize_sched();
+	if (old != &palloc_boot_colors) {
+		vfree(old->block_color);
+		kfree(old->offset_color);
+		kfree(old);
+	}
+	palloc_flush_all();
+	return 0;
+}
 
 struct palloc_stat {
 	s64 max_ns;
@@ -110,8 +333,6 @@ static struct {
 	struct palloc_stat stat[3]; /* 0 - color, 1 - normal, 2 - fail */
 } palloc;
 
-static void palloc_flush(struct zone *zone);
-
 static ssize_t palloc_write(struct file *filp, const char __user *ubuf,
 				      size_t cnt, loff_t *ppos)
 {
@@ -128,16 +349,8 @@ static ssize_t palloc_write(struct file *filp, const char __user *ubuf,
 			palloc.stat[i].min_ns = 0x7fffffff;
 		}
 	} else if (!strncmp(buf, "flush", 5)) {
-		struct zone *zone;
 		printk(KERN_INFO "flush color cache...\n");
-		for_each_populated_zone(zone) {
-			unsigned long flags;
-			if (!zone)
-				continue;
-			spin_lock_irqsave(&zone->lock, flags);
-			palloc_flush(zone);
-			spin_unlock_irqrestore(&zone->lock, flags);
-		}
+		palloc_flush_all();
 	} else if (!strncmp(buf, "xor", 3)) {
 		int bit, xor_bit;
 		sscanf(buf + 4, "%d %d", &bit, &xor_bit);
@@ -145,7 +358,12 @@ static ssize_t palloc_write(struct file *filp, const char __user *ubuf,
 		    (xor_bit > 0 && xor_bit < 64) && 
 		    bit != xor_bit) 
 		{
+			mutex_lock(&palloc_config_mutex);
 			mc_xor_bits[bit] = xor_bit;
+			palloc_custom_hash = 0;
+			palloc_config_changed();
+			mutex_unlock(&palloc_config_mutex);
+			palloc_rebuild_cmaps();
 		}
 	}
 
@@ -155,6 +373,7 @@ static ssize_t palloc_write(struct file *filp, const char __user *ubuf,
 
 static int palloc_show(struct seq_file *m, void *v)
 {
+	struct palloc_colors *pc;
 	int i, tmp;
 	char *desc[] = { "Color", "Normal", "Fail" };
 	char buf[256];
@@ -191,7 +410,21 @@ static int palloc_show(struct seq_file *m, void *v)
 			seq_printf(m, "   %3d <-> %3d\n", i, mc_xor_bits[i]);
 	}
 
+	mutex_lock(&palloc_config_mutex);
+	pc = rcu_dereference_protected(palloc_colors,
+				lockdep_is_held(&palloc_config_mutex));
+	seq_printf(m, "hash: %s\n", (palloc_custom_hash) ? "custom" : "mask");
+	for (i = 0; i < pc->nr_bits; i++)
+		seq_printf(m, "   color bit %d = parity(addr & 0x%llx)\n",
+			   i, pc->hash[i]);
+	mutex_unlock(&palloc_config_mutex);
+
+	seq_printf(m, "cache bits: 0x%x  bank bits: 0x%x\n",
+		   palloc_cache_mask(), ~palloc_cache_mask() & (palloc_bins() - 1));
+
 	seq_printf(m, "Use PALLOC: %s\n", (use_palloc) ? "enabled" : "disabled");
+	seq_printf(m, "High order: %s\n",
+		   (use_palloc_high_order) ? "enabled" : "disabled");
         return 0;
 }
 static int palloc_open(struct inode *inode, struct file *filp)
@@ -207,6 +440,157 @@ static const struct file_operations palloc_fops = {
         .release        = single_release,
 };
 
+static int palloc_mask_get(void *data, u64 *val)
+{
+	*val = sysctl_palloc_mask;
+	return 0;
+}
+
+static int palloc_mask_set(void *data, u64 val)
+{
+	int ret;
+
+	mutex_lock(&palloc_config_mutex);
+	sysctl_palloc_mask = (unsigned long)val;
+	palloc_custom_hash = 0;
+	ret = palloc_config_changed();
+	mutex_unlock(&palloc_config_mutex);
+	palloc_rebuild_cmaps();
+	return ret;
+}
+DEFINE_SIMPLE_ATTRIBUTE(palloc_mask_fops, palloc_mask_get, palloc_mask_set,
+			"0x%llx\n");
+
+/* have kcolord pick up a new use_palloc or balance_ms right away */
+static void palloc_balance_changed(void)
+{
+	int nid;
+
+	palloc_balance_seq++;
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		wake_up_interruptible(&NODE_DATA(nid)->kcolord_wait);
+}
+
+/* u32 knobs that change the meaning of a page's color */
+static int palloc_knob_get(void *data, u64 *val)
+{
+	*val = *(int *)data;
+	return 0;
+}
+
+static int palloc_knob_set(void *data, u64 val)
+{
+	int ret;
+
+	mutex_lock(&palloc_config_mutex);
+	/* the page owners only cost memory once palloc is used */
+	if (data == &use_palloc && val && !palloc_page_owner) {
+		palloc_page_owner = vzalloc(max_pfn * sizeof(u32));
+		smp_wmb();
+		if (palloc_page_owner)
+			palloc_nr_owner = max_pfn;
+	}
+	*(int *)data = (int)val;
+	ret = palloc_config_changed();
+	mutex_unlock(&palloc_config_mutex);
+	palloc_rebuild_cmaps();
+	if (data == &use_palloc) {
+		palloc_balance_changed();
+		palloc_reserve_toggled();
+	}
+	return ret;
+}
+DEFINE_SIMPLE_ATTRIBUTE(palloc_knob_fops, palloc_knob_get, palloc_knob_set,
+			"%llu\n");
+
+static int palloc_balance_get(void *data, u64 *val)
+{
+	*val = palloc_balance_ms;
+	return 0;
+}
+
+static int palloc_balance_set(void *data, u64 val)
+{
+	if (val > UINT_MAX)
+		return -EINVAL;
+	palloc_balance_ms = val;
+	palloc_balance_changed();
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(palloc_balance_fops, palloc_balance_get,
+			palloc_balance_set, "%llu\n");
+
+/*
+ * "hash" takes one hex address mask per color bit, lowest bit first.
+ * An empty write goes back to the masks derived from palloc_mask.
+ */
+static ssize_t palloc_hash_write(struct file *filp, const char __user *ubuf,
+				 size_t cnt, loff_t *ppos)
+{
+	char buf[MAX_PALLOC_BITS * 20 + 1];
+	u64 hash[MAX_PALLOC_BITS];
+	char *p, *tok;
+	int i, n = 0, ret;
+
+	if (cnt > sizeof(buf) - 1)
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = '\0';
+
+	p = strim(buf);
+	while ((tok = strsep(&p, " \t\n")) != NULL) {
+		if (!*tok)
+			continue;
+		if (n >= MAX_PALLOC_BITS || kstrtoull(tok, 0, &hash[n]))
+			return -EINVAL;
+		if (!(hash[n] & PAGE_MASK))
+			return -EINVAL;
+		n++;
+	}
+
+	mutex_lock(&palloc_config_mutex);
+	for (i = 0; i < n; i++)
+		palloc_custom[i] = hash[i];
+	palloc_custom_bits = n;
+	palloc_custom_hash = (n > 0);
+	ret = palloc_config_changed();
+	mutex_unlock(&palloc_config_mutex);
+	palloc_rebuild_cmaps();
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+	return cnt;
+}
+
+static int palloc_hash_show(struct seq_file *m, void *v)
+{
+	struct palloc_colors *pc;
+	int i;
+
+	rcu_read_lock_sched();
+	pc = palloc_cfg();
+	for (i = 0; i < pc->nr_bits; i++)
+		seq_printf(m, "0x%llx ", pc->hash[i]);
+	rcu_read_unlock_sched();
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int palloc_hash_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, palloc_hash_show, NULL);
+}
+
+static const struct file_operations palloc_hash_fops = {
+	.open		= palloc_hash_open,
+	.write		= palloc_hash_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __init palloc_debugfs(void)
 {
         umode_t mode = S_IFREG | S_IRUSR | S_IWUSR;
@@ -221,20 +605,48 @@ static int __init palloc_debugfs(void)
 		palloc.stat[i].min_ns = 0x7fffffff;
 	}
 
+	/* pfns past the tables, e.g. hotplugged, are hashed on the fly */
+	palloc_nr_blocks = DIV_ROUND_UP(max_pfn, pageblock_nr_pages);
+	mutex_lock(&palloc_config_mutex);
+	palloc_config_changed();
+	mutex_unlock(&palloc_config_mutex);
+	palloc_rebuild_cmaps();
+
         if (!dir)
                 return PTR_ERR(dir);
         if (!debugfs_create_file("control", mode, dir, NULL, &palloc_fops))
                 goto fail;
-	if (!debugfs_create_u64("palloc_mask", mode, dir, (u64 *)&sysctl_palloc_mask))
+	if (!debugfs_create_file("hash", mode, dir, NULL, &palloc_hash_fops))
+		goto fail;
+	if (!debugfs_create_file("palloc_mask", mode, dir, NULL,
+				 &palloc_mask_fops))
+		goto fail;
+	if (!debugfs_create_file("use_mc_xor", mode, dir, &use_mc_xor,
+				 &palloc_knob_fops))
+		goto fail;
+	if (!debugfs_create_file("use_palloc", mode, dir, &use_palloc,
+				 &palloc_knob_fops))
+		goto fail;
+	if (!debugfs_create_file("cache_bits", mode, dir, &palloc_cache_bits,
+				 &palloc_knob_fops))
+		goto fail;
+	if (!debugfs_create_u32("high_order", mode, dir,
+				&use_palloc_high_order))
 		goto fail;
-        if (!debugfs_create_u32("use_mc_xor", mode, dir, &use_mc_xor))
-                goto fail;
-        if (!debugfs_create_u32("use_palloc", mode, dir, &use_palloc))
-                goto fail;
         if (!debugfs_create_u32("debug_level", mode, dir, &memdbg_enable))
                 goto fail;
 	if (!debugfs_create_u32("alloc_balance", mode, dir, &sysctl_alloc_balance))
 		goto fail;
+	if (!debugfs_create_file("balance_ms", mode, dir, NULL,
+				 &palloc_balance_fops))
+		goto fail;
+	if (!debugfs_create_u32("color_min", mode, dir, &palloc_color_min))
+		goto fail;
+	if (!debugfs_create_u32("color_max", mode, dir, &palloc_color_max))
+		goto fail;
+	if (!debugfs_create_u32("strict_retries", mode, dir,
+				&palloc_strict_retries))
+		goto fail;
         return 0;
 fail:
         debugfs_remove_recursive(dir);
@@ -288,6 +700,7 @@ unsigned long totalreserve_pages __read_mostly;
 unsigned long dirty_balance_reserve __read_mostly;
 
 int percpu_pagelist_fraction;
+int percpu_pagelist_autotune = 1;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
 #ifdef CONFIG_PM_SLEEP
@@ -708,6 +1121,81 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
  * -- wli
  */
 
+#ifdef CONFIG_CGROUP_PALLOC
+/* index key of a free block: color of its first page minus varying bits */
+static inline int palloc_block_key(struct palloc_colors *pc,
+				   struct page *page, int order)
+{
+	return __page_to_color(pc, page) & ~pc->order_vmask[order];
+}
+
+/*
+ * The blocks of a key on free_list[migratetype] of an order are kept
+ * next to each other, free_area[order].color_first[migratetype][key]
+ * pointing at the first of them, so that the blocks that may hold a
+ * color are found without walking the free list. The keys are those of
+ * zone->color_cfg; the index is unused while it is NULL.
+ */
+
+/*
+ * Index a block just added to free_list[migratetype]: move it next to
+ * the blocks of its key, or make it the first of them.
+ * zone->lock must be hold before calling this function
+ */
+static inline void palloc_index_add(struct zone *zone, struct page *page,
+				    int order, int migratetype)
+{
+	struct palloc_colors *pc = zone->color_cfg;
+	struct page **first;
+
+	if (!pc || migratetype >= MIGRATE_PCPTYPES)
+		return;
+	first = &zone->free_area[order].color_first[migratetype]
+		[palloc_block_key(pc, page, order)];
+	if (*first)
+		list_move(&page->lru, &(*first)->lru);
+	else
+		*first = page;
+}
+
+/*
+ * Unindex a block about to be unlinked from its free list.
+ * zone->lock must be hold before calling this function
+ */
+static inline void palloc_index_del(struct zone *zone, struct page *page,
+				    int order)
+{
+	struct palloc_colors *pc = zone->color_cfg;
+	struct free_area *area = &zone->free_area[order];
+	struct page *next;
+	int key, t;
+
+	if (!pc)
+		return;
+	key = palloc_block_key(pc, page, order);
+	for (t = 0; t < MIGRATE_PCPTYPES; t++) {
+		if (area->color_first[t][key] != page)
+			continue;
+		next = list_entry(page->lru.next, struct page, lru);
+		if (&next->lru == &area->free_list[t] ||
+		    palloc_block_key(pc, next, order) != key)
+			next = NULL;
+		area->color_first[t][key] = next;
+		return;
+	}
+}
+#else
+static inline void palloc_index_add(struct zone *zone, struct page *page,
+				    int order, int migratetype)
+{
+}
+
+static inline void palloc_index_del(struct zone *zone, struct page *page,
+				    int order)
+{
+}
+#endif /* CONFIG_CGROUP_PALLOC */
+
 static inline void __free_one_page(struct page *page,
 		struct zone *zone, unsigned int order,
 		int migratetype)
@@ -742,6 +1230,7 @@ static inline void __free_one_page(struct page *page,
 			set_page_private(page, 0);
 			__mod_zone_page_state(zone, NR_FREE_PAGES, 1 << order);
 		} else {
+			palloc_index_del(zone, buddy, order);
 			list_del(&buddy->lru);
 			zone->free_area[order].nr_free--;
 			rmv_page_order(buddy);
@@ -777,6 +1266,7 @@ static inline void __free_one_page(struct page *page,
 	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
 out:
 	zone->free_area[order].nr_free++;
+	palloc_index_add(zone, page, order, migratetype);
 }
 
 /*
@@ -816,12 +1306,59 @@ static inline int free_pages_check(struct page *page)
  * And clear the zone's pages_scanned counter, to hold off the "all pages are
  * pinned" detection logic.
  */
+#ifdef CONFIG_CGROUP_PALLOC
+/*
+ * Free count pages from the per-cpu color lists back to the buddy
+ * allocator, taking one page per color in turn.
+ * zone->lock must be held before calling this function
+ */
+static void palloc_free_pcp_colors(struct zone *zone, int count,
+				   struct per_cpu_pages *pcp)
+{
+	struct page *page;
+	int c, t = 0, empty = 0;
+
+	while (count && empty < MIGRATE_PCPTYPES) {
+		if (bitmap_empty(pcp->color_bitmap[t], MAX_PALLOC_BINS)) {
+			empty++;
+			goto next;
+		}
+		empty = 0;
+		for_each_set_bit(c, pcp->color_bitmap[t], MAX_PALLOC_BINS) {
+			page = list_entry(pcp->color_lists[t][c].prev,
+					  struct page, lru);
+			list_del(&page->lru);
+			if (list_empty(&pcp->color_lists[t][c]))
+				bitmap_clear(pcp->color_bitmap[t], c, 1);
+			pcp->color_count--;
+			__free_one_page(page, zone, 0, page_private(page));
+			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			if (--count == 0)
+				break;
+		}
+next:
+		if (++t == MIGRATE_PCPTYPES)
+			t = 0;
+	}
+	VM_BUG_ON(count);
+}
+#endif /* CONFIG_CGROUP_PALLOC */
+
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
 	int migratetype = 0;
 	int batch_free = 0;
 	int to_free = count;
+#ifdef CONFIG_CGROUP_PALLOC
+	/* colored pages are freed after the migratetype lists are empty */
+	int to_free_color = 0;
+
+	if (to_free > pcp->count - pcp->color_count) {
+		to_free_color = to_free - (pcp->count - pcp->color_count);
+		to_free -= to_free_color;
+	}
+#endif
 
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
@@ -858,6 +1395,10 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			trace_mm_page_pcpu_drain(page, 0, page_private(page));
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
+#ifdef CONFIG_CGROUP_PALLOC
+	if (to_free_color)
+		palloc_free_pcp_colors(zone, to_free_color, pcp);
+#endif
 	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
 	spin_unlock(&zone->lock);
 }
@@ -874,6 +1415,55 @@ static void free_one_page(struct zone *zone, struct page *page, int order,
 	spin_unlock(&zone->lock);
 }
 
+#ifdef CONFIG_CGROUP_PALLOC
+struct palloc *palloc_page_group(struct page *page)
+{
+	unsigned long pfn = page_to_pfn(page);
+	u32 owner;
+
+	if (pfn >= ACCESS_ONCE(palloc_nr_owner))
+		return NULL;
+	smp_rmb();
+	owner = palloc_page_owner[pfn];
+	return owner ? palloc_owner_group(owner) : NULL;
+}
+
+/* count the pages freed against the groups they were allocated for */
+static void palloc_free_account(struct page *page, unsigned int order)
+{
+	unsigned long pfn = page_to_pfn(page);
+	struct palloc *ph = NULL;
+	u32 owner, last = 0;
+	int i;
+
+	/* pages allocated with palloc on are not counted once it is off */
+	if (!use_palloc ||
+	    pfn + (1 << order) > ACCESS_ONCE(palloc_nr_owner))
+		return;
+	smp_rmb();
+	rcu_read_lock();
+	for (i = 0; i < (1 << order); i++) {
+		owner = palloc_page_owner[pfn + i];
+		if (!owner)
+			continue;
+		palloc_page_owner[pfn + i] = 0;
+		if (owner != last) {
+			ph = palloc_owner_group(owner);
+			last = owner;
+		}
+		if (ph)
+			this_cpu_inc(ph->stat->freed[
+					palloc_page_color(page + i)]);
+	}
+	rcu_read_unlock();
+}
+#else
+static inline void palloc_free_account(struct page *page,
+				       unsigned int order)
+{
+}
+#endif /* CONFIG_CGROUP_PALLOC */
+
 static bool free_pages_prepare(struct page *page, unsigned int order)
 {
 	int i;
@@ -894,6 +1484,7 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 		debug_check_no_obj_freed(page_address(page),
 					   PAGE_SIZE << order);
 	}
+	palloc_free_account(page, order);
 	arch_free_page(page, order);
 	kernel_map_pages(page, 1 << order, 0);
 
@@ -999,6 +1590,7 @@ static inline void expand(struct zone *zone, struct page *page,
 #endif
 		list_add(&page[size].lru, &area->free_list[migratetype]);
 		area->nr_free++;
+		palloc_index_add(zone, &page[size], high, migratetype);
 		set_page_order(&page[size], high);
 	}
 }
@@ -1048,30 +1640,120 @@ static int prep_new_page(struct page *page, int order, gfp_t gfp_flags)
 
 int palloc_bins(void)
 {
-	return min((1 << bitmap_weight(&sysctl_palloc_mask, 8*sizeof (unsigned long))),
-		   MAX_PALLOC_BINS);
+	int nr_bits;
+
+	rcu_read_lock_sched();
+	nr_bits = palloc_cfg()->nr_bits;
+	rcu_read_unlock_sched();
+	return 1 << nr_bits;
 }
 
-static inline int page_to_color(struct page *page)
+int palloc_page_color(struct page *page)
 {
-	int color = 0;
-	int idx = 0;
-	int c;
-	unsigned long paddr = page_to_phys(page);
-	for_each_set_bit(c, &sysctl_palloc_mask, sizeof(unsigned long) * 8) {
-		if (use_mc_xor) {
-			if (((paddr >> c) & 0x1) ^ ((paddr >> mc_xor_bits[c]) & 0x1))
-				color |= (1<<idx);
-		} else {
-			if ((paddr >> c) & 0x1)
-				color |= (1<<idx);
-		}
-		idx++;
-	}
+	int color;
+
+	rcu_read_lock_sched();
+	color = page_to_color(page);
+	rcu_read_unlock_sched();
 	return color;
 }
 
-/* debug */
+int palloc_cache_mask(void)
+{
+	return palloc_cache_bits & (palloc_bins() - 1);
+}
+
+/*
+ * Return the palloc group the current task allocates for. Interrupt
+ * context, e.g. network receive, allocates for no task in particular,
+ * not for the one it interrupted.
+ */
+static inline struct palloc *palloc_current(void)
+{
+	struct palloc *ph;
+
+	if (in_interrupt())
+		return palloc_top();
+	ph = current->palloc;
+	if (!ph)
+		ph = ph_from_subsys(current->cgroups->subsys[palloc_subsys_id]);
+	return ph;
+}
+
+/*
+ * True if the strict policy of ph applies to the allocation in progress:
+ * not to one in interrupt context, made for whatever task it interrupted,
+ * nor once palloc_strict_give_up() let it fall back.
+ */
+static inline int palloc_is_strict(struct palloc *ph)
+{
+	return ph->policy == PALLOC_POLICY_STRICT && !in_interrupt() &&
+		!current->palloc_nostrict;
+}
+
+/* the colors of an MPOL_COLOR memory policy the allocation obeys */
+static inline const unsigned long *palloc_policy_colors(void)
+{
+	return in_interrupt() ? NULL : current->palloc_colors;
+}
+
+/*
+ * Return the color map of palloc group ph. If the group has no bins
+ * assigned, tmpcmap is filled and returned instead. A color memory
+ * policy narrows the bins down to its colors, unless it leaves none.
+ */
+static inline unsigned long *palloc_cmap(struct palloc *ph,
+					 unsigned long *tmpcmap)
+{
+	const unsigned long *colors = palloc_policy_colors();
+
+	if (unlikely(colors)) {
+		if (!ph || !ph->nr_cmap) {
+			bitmap_copy(tmpcmap, colors, MAX_PALLOC_BINS);
+			return tmpcmap;
+		}
+		if (bitmap_and(tmpcmap, ph->cmap, colors, MAX_PALLOC_BINS))
+			return tmpcmap;
+	}
+	if (ph && ph->nr_cmap)
+		return ph->cmap;
+
+	bitmap_fill(tmpcmap, MAX_PALLOC_BINS);
+	return tmpcmap;
+}
+
+/*
+ * Set in nmap the colors that are not in cmap but differ from one of
+ * its colors in a single color bit, i.e. share all but one cache or
+ * bank bit with it.
+ */
+static void palloc_neighbors(unsigned long *nmap, unsigned long *cmap)
+{
+	int c, b;
+
+	bitmap_zero(nmap, MAX_PALLOC_BINS);
+	for_each_set_bit(c, cmap, MAX_PALLOC_BINS) {
+		for (b = 0; b < palloc_cfg()->nr_bits; b++)
+			__set_bit(c ^ (1 << b), nmap);
+	}
+	bitmap_andnot(nmap, nmap, cmap, MAX_PALLOC_BINS);
+}
+
+/* pick the first color of mask after the one ph got last, round-robin */
+static inline int palloc_interleave_color(struct palloc *ph,
+					  unsigned long *mask)
+{
+	int c;
+
+	c = find_next_bit(mask, MAX_PALLOC_BINS,
+			  ACCESS_ONCE(ph->interleave_next) % MAX_PALLOC_BINS);
+	if (c >= MAX_PALLOC_BINS)
+		c = find_first_bit(mask, MAX_PALLOC_BINS);
+	ph->interleave_next = c + 1;
+	return c;
+}
+
+/* debug */
 static inline unsigned long list_count(struct list_head *head)
 {
 	unsigned long n = 0;
@@ -1081,35 +1763,81 @@ static inline unsigned long list_count(struct list_head *head)
 	return n;
 }
 
-/* move all color_list pages into free_area[0].freelist[2]
+/* max. number of pages freed from the color cache per hold of zone->lock */
+#define PALLOC_FLUSH_BATCH 64
+
+/*
+ * Give up to nr pages of color list c back to the buddy allocator,
+ * keeping at least keep. Return the number of pages freed.
+ * zone->lock must be hold before calling this function
+ */
+static int palloc_shrink_color(struct zone *zone, int c, int nr,
+			       unsigned int keep)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < nr && zone->color_nr[c] > keep; i++) {
+		page = list_entry(zone->color_list[c].prev, struct page, lru);
+		list_del(&page->lru);
+		zone->color_nr[c]--;
+		zone->free_area[0].nr_free--;
+		__free_one_page(page, zone, 0, get_pageblock_migratetype(page));
+	}
+	if (list_empty(&zone->color_list[c]))
+		bitmap_clear(zone->color_bitmap, c, 1);
+	return i;
+}
+
+#ifdef CONFIG_MEMORY_HOTREMOVE
+/* move all color_list pages back to the buddy free lists
  * zone->lock must be hold before calling this function
  */
 static void palloc_flush(struct zone *zone)
 {
+	unsigned long nr = 0;
 	int c;
-	struct page *page;
-	memdbg(2, "flush the ccache for zone %s\n", zone->name);
-
-	while (1) {
-		for (c = 0; c < MAX_PALLOC_BINS; c++) {
-			if (!list_empty(&zone->color_list[c])) {
-				page = list_entry(zone->color_list[c].next, 
-						  struct page, lru);
-				list_del_init(&page->lru);
-				/* FIXME: MIGRATE_UNMOVABLE? */
-				__free_one_page(page, zone, 0, get_pageblock_migratetype(page)); 
-				zone->free_area[0].nr_free--;
-			}
 
-			if (list_empty(&zone->color_list[c])) {
-				bitmap_clear(zone->color_bitmap, c, 1);
-				INIT_LIST_HEAD(&zone->color_list[c]);
-			}
-		}
+	for_each_set_bit(c, zone->color_bitmap, MAX_PALLOC_BINS)
+		nr += palloc_shrink_color(zone, c, INT_MAX, 0);
+	trace_palloc_flush(zone, nr);
+}
+#endif
 
-		if (bitmap_weight(zone->color_bitmap, MAX_PALLOC_BINS) == 0)
-			break;
+/*
+ * Shrink the color lists of a zone to keep pages, and the ones not in
+ * zone->color_used to cold_keep pages. At most PALLOC_FLUSH_BATCH pages
+ * are freed per hold of zone->lock.
+ */
+static void palloc_shrink_zone(struct zone *zone, unsigned int cold_keep,
+			       unsigned int keep)
+{
+	unsigned long flags, nr = 0;
+	unsigned int k;
+	int c = 0, budget, freed;
+
+	while (c < MAX_PALLOC_BINS) {
+		spin_lock_irqsave(&zone->lock, flags);
+		for (budget = PALLOC_FLUSH_BATCH;
+		     budget > 0 && c < MAX_PALLOC_BINS; c++) {
+			k = test_bit(c, zone->color_used) ? keep : cold_keep;
+			freed = palloc_shrink_color(zone, c, budget, k);
+			budget -= freed;
+			nr += freed;
+			if (zone->color_nr[c] > k)
+				break;
+		}
+		spin_unlock_irqrestore(&zone->lock, flags);
+		cond_resched();
 	}
+	if (nr)
+		trace_palloc_flush(zone, nr);
+}
+
+/* empty the color cache of a zone without a long zone->lock hold */
+static void palloc_flush_zone(struct zone *zone)
+{
+	palloc_shrink_zone(zone, 0, 0);
 }
 
 /* move a page (size=1<<order) into a order-0 colored cache */
@@ -1119,6 +1847,7 @@ static void palloc_insert(struct zone *zone, struct page *page, int order)
 	/* 1 page (2^order) -> 2^order x pages of colored cache. */
 
 	/* remove from zone->free_area[order].free_list[mt] */
+	palloc_index_del(zone, page, order);
 	list_del(&page->lru);
 	zone->free_area[order].nr_free--;
 	
@@ -1126,19 +1855,90 @@ static void palloc_insert(struct zone *zone, struct page *page, int order)
 	for (i = 0; i < (1<<order); i++) {
 		color = page_to_color(&page[i]);
 		/* add to zone->color_list[color] */
-		memdbg(5, "- add pfn %ld (0x%08llx) to color_list[%d]\n", 
-		       page_to_pfn(&page[i]), (u64)page_to_phys(&page[i]), color);
 		INIT_LIST_HEAD(&page[i].lru);
 		list_add_tail(&page[i].lru, &zone->color_list[color]);
+		zone->color_nr[color]++;
 		bitmap_set(zone->color_bitmap, color, 1);
 		zone->free_area[0].nr_free++;
 		rmv_page_order(&page[i]);
 	}
-	memdbg(4, "add order=%d zone=%s\n", order, zone->name);
+	trace_palloc_insert(zone, page, order);
+}
+
+/*
+ * Rebuild the free_area[].color_first index of a zone, regrouping the
+ * free lists by key, if it is not built for the current color
+ * configuration.
+ * zone->lock must be hold before calling this function
+ */
+static void palloc_index_sync(struct zone *zone)
+{
+	struct palloc_colors *pc = palloc_cfg();
+	struct free_area *area;
+	struct page *page, *next;
+	LIST_HEAD(blocks);
+	unsigned long nr = 0;
+	int order, t;
+
+	if (likely(zone->color_cfg == pc))
+		return;
+
+	zone->color_cfg = pc;
+	for (order = 0; order < MAX_ORDER; order++) {
+		area = &zone->free_area[order];
+		memset(area->color_first, 0, sizeof(area->color_first));
+		for (t = 0; t < MIGRATE_PCPTYPES; t++) {
+			list_splice_init(&area->free_list[t], &blocks);
+			list_for_each_entry_safe(page, next, &blocks, lru) {
+				list_move_tail(&page->lru, &area->free_list[t]);
+				palloc_index_add(zone, page, order, t);
+				nr++;
+			}
+		}
+	}
+	trace_palloc_index_rebuild(zone, nr);
+}
+
+/*
+ * Set in keys the index keys of the order blocks that may hold a color
+ * in cmap. Return 0 if free_list[migratetype] has no block with any of
+ * them.
+ */
+static int palloc_want_keys(struct zone *zone, int order, int migratetype,
+			    unsigned long *cmap, unsigned long *keys)
+{
+	struct page **first = zone->free_area[order].color_first[migratetype];
+	int vmask = zone->color_cfg->order_vmask[order];
+	int c;
+
+	bitmap_zero(keys, MAX_PALLOC_BINS);
+	for_each_set_bit(c, cmap, MAX_PALLOC_BINS)
+		__set_bit(c & ~vmask, keys);
+
+	for_each_set_bit(c, keys, MAX_PALLOC_BINS) {
+		if (first[c])
+			return 1;
+	}
+	return 0;
+}
+
+/* the block after page on free_list[migratetype] if it has key too */
+static inline struct page *palloc_next_block(struct zone *zone,
+					     struct page *page, int order,
+					     int migratetype, int key)
+{
+	struct free_area *area = &zone->free_area[order];
+
+	page = list_entry(page->lru.next, struct page, lru);
+	if (&page->lru == &area->free_list[migratetype] ||
+	    palloc_block_key(zone->color_cfg, page, order) != key)
+		return NULL;
+	return page;
 }
 
 /* return a colored page (order-0) and remove it from the colored cache */
-static inline struct page *palloc_find_cmap(struct zone *zone, COLOR_BITMAP(cmap),
+static inline struct page *palloc_find_cmap(struct zone *zone,
+				     struct palloc *ph, COLOR_BITMAP(cmap),
 				     int order,
 				     struct palloc_stat *stat)
 {
@@ -1147,7 +1947,7 @@ static inline struct page *palloc_find_cmap(struct zone *zone, COLOR_BITMAP(cmap
 	int c;
 	unsigned int tmp_idx;
 	int found_w, want_w;
-	long rand_seed;
+	long rand_seed = 0;
 	/* cache statistics */
 	if (stat) stat->cache_acc_cnt++;
 	
@@ -1168,8 +1968,6 @@ static inline struct page *palloc_find_cmap(struct zone *zone, COLOR_BITMAP(cmap
 		ktime_t dur = ktime_sub(ktime_get(), stat->start);
 		if (dur.tv64 < 1000000) {
 			/* try to balance unless order=MAX-2 or 1ms has passed */
-			memdbg(4, "found_w=%d want_w=%d order=%d elapsed=%lld ns\n",
-			       found_w, want_w, order, dur.tv64);
 			stat->alloc_balance++;
 
 			return NULL;
@@ -1178,6 +1976,11 @@ static inline struct page *palloc_find_cmap(struct zone *zone, COLOR_BITMAP(cmap
 	}
 
 	/* choose a bit among the candidates */
+	if (ph->policy == PALLOC_POLICY_INTERLEAVE) {
+		c = palloc_interleave_color(ph, tmpmask);
+		goto found;
+	}
+
 	if (sysctl_alloc_balance && memdbg_enable) {
 		rand_seed = (long)stat->start.tv64;
 	} else {
@@ -1191,34 +1994,255 @@ static inline struct page *palloc_find_cmap(struct zone *zone, COLOR_BITMAP(cmap
 		if (tmp_idx-- <= 0) 
 			break;
 	}
+found:
 
 
 	BUG_ON(c >= MAX_PALLOC_BINS);
 	BUG_ON(list_empty(&zone->color_list[c]));
 	
 	page = list_entry(zone->color_list[c].next, struct page, lru);
-	
-	memdbg(1, "Found colored page pfn %ld color %d seed %ld found/want %d/%d\n",
-	       page_to_pfn(page), c, rand_seed, found_w, want_w);
+	trace_palloc_find_cmap(page, c, found_w, want_w);
 
 	/* remove from the zone->color_list[color] */
 	list_del(&page->lru);
+	zone->color_nr[c]--;
+	__set_bit(c, zone->color_used);
 	if (list_empty(&zone->color_list[c]))
 		bitmap_clear(zone->color_bitmap, c, 1);
 	zone->free_area[0].nr_free--;
 
-	memdbg(5, "- del pfn %ld from color_list[%d]\n",
-	       page_to_pfn(page), c);
-
 	if (stat) stat->cache_hit_cnt++;
 	return page;
 }
 
+/*
+ * Like expand(), but keep the order-low sub-block at 'target' instead of
+ * the first one and return the other halves to the free lists.
+ */
+static inline void palloc_expand(struct zone *zone, struct page *page,
+		struct page *target, int low, int high, struct free_area *area,
+		int migratetype)
+{
+	unsigned long size = 1 << high;
+	struct page *buddy;
+
+	while (high > low) {
+		area--;
+		high--;
+		size >>= 1;
+		if (target >= page + size) {
+			buddy = page;
+			page += size;
+		} else {
+			buddy = page + size;
+		}
+		VM_BUG_ON(bad_range(zone, buddy));
+		list_add(&buddy->lru, &area->free_list[migratetype]);
+		area->nr_free++;
+		set_page_order(buddy, high);
+		palloc_index_add(zone, buddy, high, migratetype);
+	}
+	VM_BUG_ON(page != target);
+}
+
+/*
+ * Remove a free block of the given order whose colors all lie in cmap
+ * from the free lists. A larger block holding such a sub-block is split
+ * around it. Return NULL if the zone has no compliant block.
+ * zone->lock must be hold before calling this function
+ */
+static struct page *palloc_rmqueue_high(struct zone *zone, unsigned int order,
+					int migratetype, unsigned long *cmap,
+					int *iters)
+{
+	unsigned int current_order;
+	struct free_area *area;
+	struct page *page, *sub;
+	COLOR_BITMAP(okeys);
+	COLOR_BITMAP(keys);
+	int vmask, c, s, i, key;
+
+	/* only the pcp migrate types are indexed */
+	if (migratetype >= MIGRATE_PCPTYPES)
+		return NULL;
+	palloc_index_sync(zone);
+
+	/* keys of the order blocks whose colors are all in cmap */
+	vmask = zone->color_cfg->order_vmask[order];
+	bitmap_zero(okeys, MAX_PALLOC_BINS);
+	for_each_set_bit(c, cmap, MAX_PALLOC_BINS) {
+		if (c & vmask)
+			continue;
+		s = 0;
+		do {
+			if (!test_bit(c | s, cmap))
+				break;
+			s = (s - vmask) & vmask;
+		} while (s);
+		if (!s)
+			__set_bit(c, okeys);
+	}
+	if (bitmap_empty(okeys, MAX_PALLOC_BINS))
+		return NULL;
+
+	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
+		area = &(zone->free_area[current_order]);
+		if (!palloc_want_keys(zone, current_order, migratetype, okeys,
+				      keys))
+			continue;
+		for_each_set_bit(key, keys, MAX_PALLOC_BINS) {
+			for (page = area->color_first[migratetype][key]; page;
+			     page = palloc_next_block(zone, page, current_order,
+						      migratetype, key)) {
+				(*iters)++;
+				for (i = 0; i < (1 << (current_order - order));
+				     i++) {
+					sub = page + (i << order);
+					if (test_bit(palloc_block_key(
+							zone->color_cfg, sub,
+							order), okeys))
+						goto found;
+				}
+			}
+		}
+	}
+	return NULL;
+
+found:
+	palloc_index_del(zone, page, current_order);
+	list_del(&page->lru);
+	rmv_page_order(page);
+	area->nr_free--;
+	palloc_expand(zone, page, sub, order, current_order, area, migratetype);
+	return sub;
+}
+
+/* true if all colors of a block of key, varying in vmask, are in cmap */
+static int palloc_key_in_cmap(int key, int vmask, const unsigned long *cmap)
+{
+	int s = 0;
+
+	do {
+		if (!test_bit(key | s, cmap))
+			return 0;
+		s = (s - vmask) & vmask;
+	} while (s);
+	return 1;
+}
+
+/* true if all colors of the order block at page are in cmap */
+static int palloc_block_in_cmap(struct palloc_colors *pc, struct page *page,
+				int order, unsigned long *cmap)
+{
+	return palloc_key_in_cmap(palloc_block_key(pc, page, order),
+				  pc->order_vmask[order], cmap);
+}
+
+/*
+ * True if ph, NULL for the current task's group, can be given a block
+ * of an order within its bins: it is not restricted, or high order
+ * coloring is on and the colors of some aligned block are all in them.
+ */
+int palloc_order_fits(struct palloc *ph, int order)
+{
+	struct palloc_colors *pc;
+	int c, vmask, ret = 0;
+
+	if (!ph)
+		ph = palloc_current();
+	if (!use_palloc || !ph->nr_cmap)
+		return 1;
+	if (!use_palloc_high_order)
+		return 0;
+
+	rcu_read_lock_sched();
+	pc = palloc_cfg();
+	vmask = pc->order_vmask[order];
+	for_each_set_bit(c, ph->cmap, MAX_PALLOC_BINS) {
+		if (palloc_key_in_cmap(c & ~vmask, vmask, ph->cmap)) {
+			ret = 1;
+			break;
+		}
+	}
+	rcu_read_unlock_sched();
+	return ret;
+}
+
+/* true if the order block at page is in the bins of ph, see above */
+int palloc_block_fits(struct palloc *ph, struct page *page, int order)
+{
+	int ret;
+
+	if (!ph)
+		ph = palloc_current();
+	if (!use_palloc || !ph->nr_cmap)
+		return 1;
+
+	rcu_read_lock_sched();
+	ret = palloc_block_in_cmap(palloc_cfg(), page, order, ph->cmap);
+	rcu_read_unlock_sched();
+	return ret;
+}
+
+/*
+ * Account an allocation for group ph in its per-cpu statistics.
+ * Must be called with interrupts disabled.
+ */
+static void palloc_account(struct palloc *ph, struct page *page, int order,
+			   u64 start)
+{
+	struct palloc_cpu_stat *stat = this_cpu_ptr(ph->stat);
+	struct palloc_ctx *ctx = &__get_cpu_var(palloc_ctx);
+	u64 dur = local_clock() - start;
+	int restricted = ph->nr_cmap;
+	unsigned long pfn;
+	u32 *owners;
+	int i, color = -1, result;
+
+	if (!page) {
+		result = PALLOC_FAIL;
+		if (ctx->strict)
+			stat->count[PALLOC_STRICT_FAIL]++;
+	} else {
+		pfn = page_to_pfn(page);
+		owners = NULL;
+		if (pfn + (1 << order) <= ACCESS_ONCE(palloc_nr_owner)) {
+			smp_rmb();
+			owners = palloc_page_owner + pfn;
+		}
+		for (i = 0; i < (1 << order); i++) {
+			stat->color[page_to_color(page + i)]++;
+			if (owners)
+				owners[i] = palloc_owner(ph);
+		}
+		color = page_to_color(page);
+		if (restricted &&
+		    !(order ? palloc_block_in_cmap(palloc_cfg(), page, order,
+						   ph->cmap) :
+		      test_bit(color, ph->cmap))) {
+			result = ctx->neighbor ? PALLOC_NEIGHBOR :
+				PALLOC_FALLBACK;
+		} else {
+			result = ctx->miss ? PALLOC_MISS : PALLOC_HIT;
+			if (ph->policy == PALLOC_POLICY_INTERLEAVE)
+				stat->count[PALLOC_INTERLEAVE]++;
+		}
+	}
+	stat->count[result]++;
+	stat->count[PALLOC_ITERS] += ctx->iters;
+	stat->latency[min_t(int, ilog2(dur | 1), PALLOC_LAT_BUCKETS - 1)]++;
+	trace_palloc_alloc(page, order, color, result, ctx->iters, dur,
+			   palloc_owner(ph));
+	palloc_ctx_reset();
+}
+
 static inline void 
 update_stat(struct palloc_stat *stat, struct page *page, int iters)
 {
 	ktime_t dur;
 
+	if (use_palloc)
+		__this_cpu_add(palloc_ctx.iters, iters);
 	if (memdbg_enable == 0)
 		return;
 
@@ -1232,16 +2256,64 @@ update_stat(struct palloc_stat *stat, struct page *page, int iters)
 		stat->iter_cnt += iters;
 
 		stat->tot_cnt++;
-		
-		memdbg(2, "order %ld pfn %ld(0x%08llx) color %d iters %d in %lld ns\n",
-		       page_order(page), page_to_pfn(page), (u64)page_to_phys(page),
-		       (int)page_to_color(page),
-		       iters, dur.tv64);
-	} else {
-		memdbg(5, "dur %lld is < 0\n", dur.tv64);
 	}
 }
 
+/*
+ * Return an order-0 page whose color is in cmap, from the color cache or
+ * else by moving the free blocks that may hold such a color into it.
+ * zone->lock must be hold before calling this function
+ */
+static struct page *palloc_rmqueue_color(struct zone *zone, int migratetype,
+					 struct palloc *ph, unsigned long *cmap,
+					 struct palloc_stat *c_stat, int *iters)
+{
+	unsigned int current_order;
+	struct free_area *area;
+	struct page *page;
+	COLOR_BITMAP(keys);
+	int key, start;
+
+	/* find in the cache */
+	page = palloc_find_cmap(zone, ph, cmap, 0, c_stat);
+	if (page) {
+		update_stat(c_stat, page, *iters);
+		return page;
+	}
+
+	/* only the pcp migrate types are indexed */
+	if (migratetype >= MIGRATE_PCPTYPES)
+		return NULL;
+
+	/* build color cache */
+	(*iters)++;
+	start = *iters;
+	palloc_index_sync(zone);
+	/* go straight to the blocks that may hold a wanted color */
+	for (current_order = 0; current_order < MAX_ORDER; ++current_order) {
+		area = &(zone->free_area[current_order]);
+		if (!palloc_want_keys(zone, current_order, migratetype, cmap,
+				      keys))
+			continue;
+		for_each_set_bit(key, keys, MAX_PALLOC_BINS) {
+			while ((page = area->color_first[migratetype][key])) {
+				(*iters)++;
+				palloc_insert(zone, page, current_order);
+				page = palloc_find_cmap(zone, ph, cmap,
+							current_order, c_stat);
+				if (!page)
+					continue;
+				__this_cpu_write(palloc_ctx.miss, 1);
+				update_stat(c_stat, page, *iters);
+				trace_palloc_build(zone, *iters - start);
+				return page;
+			}
+		}
+	}
+	trace_palloc_build(zone, *iters - start);
+	return NULL;
+}
+
 /*
  * Go through the free lists for the given migratetype and remove
  * the smallest available page from the freelists
@@ -1252,15 +2324,15 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 {
 	unsigned int current_order;
 	struct free_area *area;
-	struct list_head *curr, *tmp;
 	struct page *page;
 
-	struct palloc *ph;
 	struct palloc_stat *c_stat = &palloc.stat[0];
 	struct palloc_stat *n_stat = &palloc.stat[1];
 	struct palloc_stat *f_stat = &palloc.stat[2];
 	int iters = 0;
 	COLOR_BITMAP(tmpcmap);
+	COLOR_BITMAP(nmap);
+	struct palloc *ph;
 	unsigned long *cmap;
 
 	if (memdbg_enable)
@@ -1270,82 +2342,70 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 		goto normal_buddy_alloc;
 
 	/* cgroup information */
-	ph = ph_from_subsys(current->cgroups->subsys[palloc_subsys_id]);
-	if (ph && bitmap_weight(ph->cmap, MAX_PALLOC_BINS) > 0)
-		cmap = ph->cmap;
-	else {
-		bitmap_fill(tmpcmap, MAX_PALLOC_BINS);
-		cmap = tmpcmap;
+	ph = palloc_current();
+	cmap = palloc_cmap(ph, tmpcmap);
+
+	if (order > 0 && use_palloc_high_order &&
+	    !bitmap_full(cmap, MAX_PALLOC_BINS)) {
+		page = palloc_rmqueue_high(zone, order, migratetype, cmap,
+					   &iters);
+		if (page) {
+			update_stat(c_stat, page, iters);
+			return page;
+		}
+		trace_palloc_fallback(zone, order, migratetype,
+				      palloc_is_strict(ph));
+		if (palloc_is_strict(ph))
+			goto out;
+		/* no compliant block: do not fail the allocation */
+		goto normal_buddy_alloc;
 	}
 
-	page = NULL;
 	if (order == 0) {
-		/* find in the cache */
-		memdbg(5, "check color cache (mt=%d)\n", migratetype);
-		page = palloc_find_cmap(zone, cmap, 0, c_stat);
+		page = palloc_rmqueue_color(zone, migratetype, ph, cmap,
+					    c_stat, &iters);
+		if (page)
+			return page;
+		trace_palloc_fallback(zone, order, migratetype,
+				      palloc_is_strict(ph));
+		if (palloc_is_strict(ph) ||
+		    bitmap_full(cmap, MAX_PALLOC_BINS))
+			goto out;
 
+		/* try the colors next to the bins, then any color */
+		palloc_neighbors(nmap, cmap);
+		page = palloc_rmqueue_color(zone, migratetype, ph, nmap,
+					    c_stat, &iters);
 		if (page) {
-			update_stat(c_stat, page, iters);
+			__this_cpu_write(palloc_ctx.neighbor, 1);
 			return page;
 		}
 	}
 
-	if (order == 0) {
-		/* build color cache */
+normal_buddy_alloc:
+	/* normal buddy */
+	/* Find a page of the appropriate size in the preferred list */
+	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
+		area = &(zone->free_area[current_order]);
 		iters++;
-		/* search the entire list. make color cache in the process  */
-		for (current_order = 0; 
-		     current_order < MAX_ORDER; ++current_order) 
-		{
-			area = &(zone->free_area[current_order]);
-			if (list_empty(&area->free_list[migratetype]))
-				continue;
-			memdbg(3, " order=%d (nr_free=%ld)\n",
-			       current_order, area->nr_free);
-			list_for_each_safe(curr, tmp, 
-					   &area->free_list[migratetype]) 
-			{
-				iters++;
-				page = list_entry(curr, struct page, lru);
-				palloc_insert(zone, page, current_order);
-				page = palloc_find_cmap(zone, cmap, current_order, c_stat);
-				if (page) {
-					update_stat(c_stat, page, iters);
-					memdbg(1, "Found at Zone %s pfn 0x%lx\n",
-					       zone->name,
-					       page_to_pfn(page));
-					return page;
-				}
-			}
-		}
-		memdbg(1, "Failed to find a matching color\n");
-	} else {
-	normal_buddy_alloc:
-		/* normal buddy */
-		/* Find a page of the appropriate size in the preferred list */
-		for (current_order = order; 
-		     current_order < MAX_ORDER; ++current_order) 
-		{
-			area = &(zone->free_area[current_order]);
-			iters++;
-			if (list_empty(&area->free_list[migratetype]))
-				continue;
-			page = list_entry(area->free_list[migratetype].next,
-					  struct page, lru);
-			
-			list_del(&page->lru);
-			rmv_page_order(page);
-			area->nr_free--;
-			expand(zone, page, order, 
-			       current_order, area, migratetype);
+		if (list_empty(&area->free_list[migratetype]))
+			continue;
+		page = list_entry(area->free_list[migratetype].next,
+				  struct page, lru);
 
-			update_stat(n_stat, page, iters);
-			return page;
-		}
+		palloc_index_del(zone, page, current_order);
+		list_del(&page->lru);
+		rmv_page_order(page);
+		area->nr_free--;
+		expand(zone, page, order, 
+		       current_order, area, migratetype);
+
+		update_stat(n_stat, page, iters);
+		return page;
 	}
+out:
 	/* no memory (color or normal) found in this zone */
-	memdbg(1, "No memory in Zone %s: order %d mt %d\n",
-	       zone->name, order, migratetype);
+	__this_cpu_add(palloc_ctx.iters, iters);
 
 	return NULL;
 }
@@ -1434,8 +2494,10 @@ static int move_freepages(struct zone *zone,
 		}
 
 		order = page_order(page);
+		palloc_index_del(zone, page, order);
 		list_move(&page->lru,
 			  &zone->free_area[order].free_list[migratetype]);
+		palloc_index_add(zone, page, order, migratetype);
 		page += 1 << order;
 		pages_moved += 1 << order;
 	}
@@ -1532,6 +2594,7 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			}
 
 			/* Remove the page from the freelists */
+			palloc_index_del(zone, page, current_order);
 			list_del(&page->lru);
 			rmv_page_order(page);
 
@@ -1545,88 +2608,572 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			       is_migrate_cma(migratetype)
 			     ? migratetype : start_migratetype);
 
-			trace_mm_page_alloc_extfrag(page, order, current_order,
-				start_migratetype, migratetype);
+			trace_mm_page_alloc_extfrag(page, order, current_order,
+				start_migratetype, migratetype);
+
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef CONFIG_CGROUP_PALLOC
+/* true if the current group may not fall back to pages outside its bins */
+static inline int palloc_strict(unsigned int order)
+{
+	return use_palloc && (order == 0 || use_palloc_high_order) &&
+		palloc_is_strict(palloc_current());
+}
+
+/*
+ * Strict policy: instead of stealing any page from the other migratetypes,
+ * look for pages in the group's bins on their free lists. MIGRATE_RESERVE
+ * is left to the caller.
+ */
+static struct page *palloc_rmqueue_strict(struct zone *zone,
+					  unsigned int order,
+					  int start_migratetype)
+{
+	struct page *page;
+	int i, migratetype;
+
+	for (i = 0;; i++) {
+		migratetype = fallbacks[start_migratetype][i];
+		if (migratetype == MIGRATE_RESERVE)
+			break;
+		page = __rmqueue_smallest(zone, order, migratetype);
+		if (page)
+			return page;
+	}
+	__this_cpu_write(palloc_ctx.strict, 1);
+	return NULL;
+}
+
+/*
+ * Called by the slowpath after a round of reclaim did not satisfy a
+ * strict group. After palloc_strict_retries rounds, or right away when
+ * the next step is the OOM killer, the allocation in progress may fall
+ * back to pages outside of the bins. Return 1 if it now may.
+ */
+static int palloc_strict_give_up(unsigned int order, int *tries, int oom)
+{
+	if (!palloc_strict(order))
+		return 0;
+	if (++(*tries) < palloc_strict_retries && !oom)
+		return 0;
+	current->palloc_nostrict = 1;
+	return 1;
+}
+
+/* the allocation that gave up on the strict policy is done */
+static inline void palloc_strict_done(int tries)
+{
+	if (tries)
+		current->palloc_nostrict = 0;
+}
+#else
+static inline int palloc_strict_give_up(unsigned int order, int *tries,
+					int oom)
+{
+	return 0;
+}
+
+static inline void palloc_strict_done(int tries)
+{
+}
+#endif
+
+/*
+ * Do the hard work of removing an element from the buddy allocator.
+ * Call me with the zone->lock already held.
+ */
+static struct page *__rmqueue(struct zone *zone, unsigned int order,
+						int migratetype)
+{
+	struct page *page;
+
+retry_reserve:
+	page = __rmqueue_smallest(zone, order, migratetype);
+
+	if (unlikely(!page) && migratetype != MIGRATE_RESERVE) {
+#ifdef CONFIG_CGROUP_PALLOC
+		if (palloc_strict(order))
+			page = palloc_rmqueue_strict(zone, order, migratetype);
+		else
+#endif
+		page = __rmqueue_fallback(zone, order, migratetype);
+
+		/*
+		 * Use MIGRATE_RESERVE rather than fail an allocation. goto
+		 * is used because __rmqueue_smallest is an inline function
+		 * and we want just one call site
+		 */
+		if (!page) {
+			migratetype = MIGRATE_RESERVE;
+			goto retry_reserve;
+		}
+	}
+
+	trace_mm_page_alloc_zone_locked(page, order, migratetype);
+	return page;
+}
+
+/*
+ * Obtain a specified number of elements from the buddy allocator, all under
+ * a single hold of the lock, for efficiency.  Add them to the supplied list.
+ * Returns the number of new pages which were placed at *list.
+ */
+static int rmqueue_bulk(struct zone *zone, unsigned int order,
+			unsigned long count, struct list_head *list,
+			int migratetype, int cold)
+{
+	int mt = migratetype, i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count; ++i) {
+		struct page *page = __rmqueue(zone, order, migratetype);
+		if (unlikely(page == NULL))
+			break;
+
+		/*
+		 * Split buddy pages returned by expand() are received here
+		 * in physical page order. The page is added to the callers and
+		 * list and the list head then moves forward. From the callers
+		 * perspective, the linked list is ordered by page number in
+		 * some conditions. This is useful for IO devices that can
+		 * merge IO requests if the physical pages are ordered
+		 * properly.
+		 */
+		if (likely(cold == 0))
+			list_add(&page->lru, list);
+		else
+			list_add_tail(&page->lru, list);
+		if (IS_ENABLED(CONFIG_CMA)) {
+			mt = get_pageblock_migratetype(page);
+			if (!is_migrate_cma(mt) && mt != MIGRATE_ISOLATE)
+				mt = migratetype;
+		}
+		set_page_private(page, mt);
+		list = &page->lru;
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
+	spin_unlock(&zone->lock);
+	return i;
+}
+
+#ifdef CONFIG_CGROUP_PALLOC
+/*
+ * Add an order-0 page to the per-cpu color list matching its migrate
+ * type, as free_hot_cold_page() files it, and its color.
+ */
+static inline void palloc_pcp_add(struct per_cpu_pages *pcp,
+				  struct page *page, int migratetype, int cold)
+{
+	int color = page_to_color(page);
+	struct list_head *list = &pcp->color_lists[migratetype][color];
+
+	if (cold)
+		list_add_tail(&page->lru, list);
+	else
+		list_add(&page->lru, list);
+	__set_bit(color, pcp->color_bitmap[migratetype]);
+	pcp->color_count++;
+	pcp->count++;
+}
+
+/*
+ * Remove a page of migratetype whose color is in cmap from the per-cpu
+ * color lists.
+ */
+static inline struct page *palloc_pcp_find(struct per_cpu_pages *pcp,
+					   struct palloc *ph,
+					   unsigned long *cmap,
+					   int migratetype, int cold)
+{
+	struct list_head *lists = pcp->color_lists[migratetype];
+	struct page *page;
+	COLOR_BITMAP(tmpmask);
+	unsigned int tmp_idx;
+	long rand_seed;
+	int c;
+
+	if (!bitmap_and(tmpmask, pcp->color_bitmap[migratetype], cmap,
+			MAX_PALLOC_BINS))
+		return NULL;
+
+	if (ph->policy == PALLOC_POLICY_INTERLEAVE) {
+		c = palloc_interleave_color(ph, tmpmask);
+		goto found;
+	}
+
+	/* spread the allocations over the candidate colors */
+	rand_seed = __this_cpu_read(palloc_rand_seed);
+	__this_cpu_write(palloc_rand_seed,
+			 (rand_seed > MAX_PALLOC_BINS) ? 0 : rand_seed + 1);
+	tmp_idx = rand_seed % bitmap_weight(tmpmask, MAX_PALLOC_BINS);
+	for_each_set_bit(c, tmpmask, MAX_PALLOC_BINS) {
+		if (tmp_idx-- == 0)
+			break;
+	}
+found:
+	if (cold)
+		page = list_entry(lists[c].prev, struct page, lru);
+	else
+		page = list_entry(lists[c].next, struct page, lru);
+	list_del(&page->lru);
+	if (list_empty(&lists[c]))
+		__clear_bit(c, pcp->color_bitmap[migratetype]);
+	pcp->color_count--;
+	pcp->count--;
+	return page;
+}
+
+/*
+ * Allocate an order-0 page in the current cgroup's bins from the per-cpu
+ * color lists. On a miss, take one page for the caller and refill the
+ * lists with up to pcp->batch colored pages under a single hold of
+ * zone->lock. Must be called with interrupts disabled.
+ */
+static struct page *palloc_rmqueue_pcp(struct zone *zone,
+				       struct per_cpu_pages *pcp,
+				       int migratetype, int cold)
+{
+	COLOR_BITMAP(tmpcmap);
+	struct palloc *ph = palloc_current();
+	unsigned long *cmap = palloc_cmap(ph, tmpcmap);
+	struct page *page, *tmp;
+	int i, mt, iters = 0;
+
+	page = palloc_pcp_find(pcp, ph, cmap, migratetype, cold);
+	if (page)
+		return page;
+
+	spin_lock(&zone->lock);
+	pcp->nr_refill++;
+	page = __rmqueue(zone, 0, migratetype);
+	if (unlikely(!page)) {
+		spin_unlock(&zone->lock);
+		return NULL;
+	}
+	for (i = 1; i < pcp->batch; i++) {
+		/* colored pages only, no policy or migratetype fallback */
+		iters = 0;
+		tmp = palloc_rmqueue_color(zone, migratetype, ph, cmap,
+					   &palloc.stat[0], &iters);
+		if (!tmp)
+			break;
+		/* the color cache mixes migrate types, file it as freed */
+		mt = get_pageblock_migratetype(tmp);
+		set_page_private(tmp, mt);
+		palloc_pcp_add(pcp, tmp, mt < MIGRATE_PCPTYPES ? mt :
+			       MIGRATE_MOVABLE, cold);
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -i);
+	spin_unlock(&zone->lock);
+	return page;
+}
+
+/*
+ * Per-node color cache rebalancer. Returns the pages of color lists that
+ * went unused for a period to the buddy allocator, so that the cache
+ * neither hoards memory nor has to be rebuilt all at once by a flush.
+ */
+static int kcolord(void *p)
+{
+	pg_data_t *pgdat = p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	unsigned int max, min;
+	unsigned long flags, seq;
+	struct zone *zone;
+	long timeout, ret;
+	int i;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		/* sleep until palloc_balance_changed() while off */
+		seq = ACCESS_ONCE(palloc_balance_seq);
+		timeout = use_palloc && palloc_balance_ms ?
+			msecs_to_jiffies(palloc_balance_ms) :
+			MAX_SCHEDULE_TIMEOUT;
+		ret = wait_event_freezable_timeout(pgdat->kcolord_wait,
+				kthread_should_stop() ||
+				palloc_balance_seq != seq, timeout);
+		if (kthread_should_stop())
+			break;
+		/* new settings: wait for the new interval */
+		if (ret > 0)
+			continue;
+
+		max = palloc_color_max ? : UINT_MAX;
+		min = min(palloc_color_min, max);
+		for (i = 0; i < pgdat->nr_zones; i++) {
+			zone = pgdat->node_zones + i;
+			if (!populated_zone(zone))
+				continue;
+			palloc_shrink_zone(zone, min, max);
+			spin_lock_irqsave(&zone->lock, flags);
+			bitmap_zero(zone->color_used, MAX_PALLOC_BINS);
+			spin_unlock_irqrestore(&zone->lock, flags);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Called by init and node-hot-add, like kswapd_run().
+ */
+int kcolord_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcolord)
+		return 0;
+
+	pgdat->kcolord = kthread_run(kcolord, pgdat, "kcolord%d", nid);
+	if (IS_ERR(pgdat->kcolord)) {
+		pr_err("Failed to start kcolord on node %d\n", nid);
+		pgdat->kcolord = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.  Caller must
+ * hold lock_memory_hotplug().
+ */
+void kcolord_stop(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+
+	if (pgdat->kcolord) {
+		kthread_stop(pgdat->kcolord);
+		pgdat->kcolord = NULL;
+	}
+}
+
+static int __init palloc_kcolord_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcolord_run(nid);
+	return 0;
+}
+late_initcall(palloc_kcolord_init);
+
+int palloc_enabled(void)
+{
+	return use_palloc;
+}
+
+void palloc_release_cold(struct zone *zone)
+{
+	if (use_palloc)
+		palloc_shrink_zone(zone, 0, UINT_MAX);
+}
+
+/* max. number of color cache entries looked at per compaction target */
+#define PALLOC_COMPACT_SCAN 16
+
+/*
+ * Compaction migrates towards the end of the zone, so only pages above
+ * its free scanner are taken.
+ */
+struct page *palloc_isolate_color_page(struct zone *zone, int color,
+				       unsigned long min_pfn)
+{
+	struct page *page, *found = NULL;
+	unsigned long flags;
+	int n = 0;
+
+	if (!use_palloc)
+		return NULL;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	/* Obey watermarks as if the page was being allocated */
+	if (!zone_watermark_ok(zone, 0, low_wmark_pages(zone) + 1, 0, 0))
+		goto out;
+	list_for_each_entry(page, &zone->color_list[color], lru) {
+		if (page_to_pfn(page) >= min_pfn) {
+			found = page;
+			break;
+		}
+		if (++n >= PALLOC_COMPACT_SCAN)
+			break;
+	}
+	if (found) {
+		list_del(&found->lru);
+		zone->color_nr[color]--;
+		zone->free_area[0].nr_free--;
+		if (list_empty(&zone->color_list[color]))
+			bitmap_clear(zone->color_bitmap, color, 1);
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -1);
+	}
+out:
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	if (found) {
+		/* as isolate_freepages() does for split_free_page() pages */
+		set_page_refcounted(found);
+		arch_alloc_page(found, 0);
+		kernel_map_pages(found, 1, 1);
+	}
+	return found;
+}
+
+/* max. number of pages moved into a reserve pool per hold of zone->lock */
+#define PALLOC_RESERVE_BATCH 32
+
+/*
+ * Move up to nr free pages of zone in the bins of ph into its reserve
+ * pool. Return the number of pages moved, none while palloc is off: only
+ * palloc_reserve_take() gives pooled pages out, and only when it is on.
+ */
+static int palloc_reserve_zone(struct palloc *ph, struct zone *zone, int nr)
+{
+	COLOR_BITMAP(tmpcmap);
+	unsigned long *cmap = palloc_cmap(ph, tmpcmap);
+	unsigned long flags;
+	struct page *page;
+	LIST_HEAD(list);
+	int i, iters = 0;
+
+	local_irq_save(flags);
+	spin_lock(&zone->lock);
+	if (!use_palloc)
+		nr = 0;
+	for (i = 0; i < nr; i++) {
+		page = palloc_rmqueue_color(zone, MIGRATE_MOVABLE, ph, cmap,
+					    &palloc.stat[0], &iters);
+		if (!page)
+			break;
+		list_add_tail(&page->lru, &list);
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -i);
+	/* not an allocation of this cpu */
+	palloc_ctx_reset();
+	spin_unlock(&zone->lock);
+
+	/* never nest zone->lock inside pool_lock, see palloc_reserve_drain() */
+	spin_lock(&ph->pool_lock);
+	list_splice_tail(&list, palloc_pool(ph, zone));
+	ph->nr_pool += i;
+	ph->node_pool[zone_to_nid(zone)] += i;
+	spin_unlock(&ph->pool_lock);
+	local_irq_restore(flags);
+	return i;
+}
+
+/* fill the pool of ph on node nid up to share pages */
+static void palloc_reserve_node(struct palloc *ph, int nid, long share)
+{
+	struct zone *zone;
+	long nr, got;
+	int i;
 
-			return page;
+	/* the zones user pages are allocated from, highest first */
+	for (i = gfp_zone(GFP_HIGHUSER_MOVABLE); i >= 0; i--) {
+		zone = &NODE_DATA(nid)->node_zones[i];
+		if (!populated_zone(zone))
+			continue;
+		for (;;) {
+			nr = share - (long)ACCESS_ONCE(ph->node_pool[nid]);
+			/* leave the zone its high watermark */
+			nr = min_t(long, nr,
+				   (long)zone_page_state(zone, NR_FREE_PAGES) -
+				   (long)high_wmark_pages(zone));
+			if (nr <= 0)
+				break;
+			got = palloc_reserve_zone(ph, zone,
+					min_t(long, nr, PALLOC_RESERVE_BATCH));
+			if (!got)
+				break;
+			cond_resched();
 		}
 	}
-
-	return NULL;
 }
 
 /*
- * Do the hard work of removing an element from the buddy allocator.
- * Call me with the zone->lock already held.
+ * The reserve is split evenly between the nodes with memory, as a fault
+ * takes from the pool of the zone it allocates from, see
+ * palloc_reserve_take().
  */
-static struct page *__rmqueue(struct zone *zone, unsigned int order,
-						int migratetype)
+unsigned long palloc_reserve_fill(struct palloc *ph)
 {
-	struct page *page;
+	long share;
+	int nid;
 
-retry_reserve:
-	page = __rmqueue_smallest(zone, order, migratetype);
+	/* filled again by palloc_reserve_toggled() once palloc is on */
+	if (!use_palloc)
+		return ph->nr_pool;
+	share = DIV_ROUND_UP(ACCESS_ONCE(ph->reserve),
+			     num_node_state(N_HIGH_MEMORY));
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		palloc_reserve_node(ph, nid, share);
+	return ph->nr_pool;
+}
 
-	if (unlikely(!page) && migratetype != MIGRATE_RESERVE) {
-		page = __rmqueue_fallback(zone, order, migratetype);
+void palloc_reserve_drain(struct palloc *ph, unsigned long keep)
+{
+	struct page *page, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+	int i;
 
-		/*
-		 * Use MIGRATE_RESERVE rather than fail an allocation. goto
-		 * is used because __rmqueue_smallest is an inline function
-		 * and we want just one call site
-		 */
-		if (!page) {
-			migratetype = MIGRATE_RESERVE;
-			goto retry_reserve;
+	local_irq_save(flags);
+	spin_lock(&ph->pool_lock);
+	/* the highest zones of the last nodes first */
+	for (i = nr_node_ids * MAX_NR_ZONES - 1; i >= 0 && ph->nr_pool > keep;
+	     i--) {
+		while (ph->nr_pool > keep && !list_empty(&ph->pool[i])) {
+			list_move(ph->pool[i].prev, &list);
+			ph->nr_pool--;
+			ph->node_pool[i / MAX_NR_ZONES]--;
 		}
 	}
+	spin_unlock(&ph->pool_lock);
 
-	trace_mm_page_alloc_zone_locked(page, order, migratetype);
-	return page;
+	list_for_each_entry_safe(page, tmp, &list, lru) {
+		list_del(&page->lru);
+		free_one_page(page_zone(page), page, 0,
+			      get_pageblock_migratetype(page));
+	}
+	local_irq_restore(flags);
 }
 
 /*
- * Obtain a specified number of elements from the buddy allocator, all under
- * a single hold of the lock, for efficiency.  Add them to the supplied list.
- * Returns the number of new pages which were placed at *list.
+ * Take a page of zone from the reserve pool of ph, and have the pool
+ * refilled when it runs low. Must be called with interrupts disabled.
  */
-static int rmqueue_bulk(struct zone *zone, unsigned int order,
-			unsigned long count, struct list_head *list,
-			int migratetype, int cold)
+static struct page *palloc_reserve_take(struct palloc *ph, struct zone *zone)
 {
-	int mt = migratetype, i;
-
-	spin_lock(&zone->lock);
-	for (i = 0; i < count; ++i) {
-		struct page *page = __rmqueue(zone, order, migratetype);
-		if (unlikely(page == NULL))
-			break;
+	struct list_head *list = palloc_pool(ph, zone);
+	struct page *page = NULL;
 
-		/*
-		 * Split buddy pages returned by expand() are received here
-		 * in physical page order. The page is added to the callers and
-		 * list and the list head then moves forward. From the callers
-		 * perspective, the linked list is ordered by page number in
-		 * some conditions. This is useful for IO devices that can
-		 * merge IO requests if the physical pages are ordered
-		 * properly.
-		 */
-		if (likely(cold == 0))
-			list_add(&page->lru, list);
-		else
-			list_add_tail(&page->lru, list);
-		if (IS_ENABLED(CONFIG_CMA)) {
-			mt = get_pageblock_migratetype(page);
-			if (!is_migrate_cma(mt) && mt != MIGRATE_ISOLATE)
-				mt = migratetype;
-		}
-		set_page_private(page, mt);
-		list = &page->lru;
+	spin_lock(&ph->pool_lock);
+	if (!list_empty(list)) {
+		page = list_first_entry(list, struct page, lru);
+		list_del(&page->lru);
+		ph->nr_pool--;
+		ph->node_pool[zone_to_nid(zone)]--;
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
-	spin_unlock(&zone->lock);
-	return i;
+	spin_unlock(&ph->pool_lock);
+
+	if (page)
+		this_cpu_ptr(ph->stat)->count[PALLOC_RESERVE]++;
+	/* the share of the node, see palloc_reserve_fill() */
+	if (ph->node_pool[zone_to_nid(zone)] *
+	    num_node_state(N_HIGH_MEMORY) < palloc_reserve_low(ph) &&
+	    list_empty(&ph->reserve_node))
+		palloc_queue_refill(ph);
+	return page;
 }
+#endif /* CONFIG_CGROUP_PALLOC */
 
 #ifdef CONFIG_NUMA
 /*
@@ -1655,6 +3202,120 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 }
 #endif
 
+/* refills or drains per interval a busy pageset is sized for */
+#define PCP_TUNE_TRIPS		16
+/* the pagesets of a zone hold at most 1/PCP_TUNE_FRACTION of it */
+#define PCP_TUNE_FRACTION	16
+/*
+ * the batch stays within the cap of setup_pagelist_highmark(), which
+ * bounds how long zone->lock is held with interrupts off
+ */
+#define PCP_TUNE_BATCH_MAX	(PAGE_SHIFT * 8)
+/* intervals an idle, tuned up pageset waits for its decay */
+#define PCP_DECAY_INTERVALS	4
+
+static DEFINE_PER_CPU(struct delayed_work, pcp_decay_work);
+
+static void pcp_decay_arm(void)
+{
+	schedule_delayed_work_on(smp_processor_id(),
+			&__get_cpu_var(pcp_decay_work),
+			round_jiffies_relative(PCP_DECAY_INTERVALS *
+					       sysctl_stat_interval));
+}
+
+/*
+ * Called from the vmstat counter updater every sysctl_stat_interval to
+ * size pageset pcp of zone after the pages allocated from and freed to
+ * it since the last call, counted per interval. The high watermark grows
+ * at once to hold what the busier of the two rates needs to cross
+ * zone->lock only PCP_TUNE_TRIPS times per interval, with the batch
+ * following it up to PCP_TUNE_BATCH_MAX, and shrinks by a quarter per
+ * interval elapsed as the rate falls, so that an idle pageset decays
+ * back to the zone's setup values and gives back the pages over its high
+ * watermark. The vmstat updater is deferrable and does not run on an
+ * idle processor, so a tuned up pageset also arms pcp_decay_work.
+ * percpu_pagelist_fraction, when set, turns the tuning off.
+ *
+ * Must be called with the thread pinned to the pageset's processor, or
+ * for a processor that is not online.
+ */
+void pcp_autotune(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	int batch, high, high_max, shrunk, to_drain;
+	unsigned long flags, elapsed, interval, steps;
+	unsigned int rate;
+	bool tuned;
+
+	local_irq_save(flags);
+	interval = max(sysctl_stat_interval, 1);
+	elapsed = max(jiffies - pcp->tune_stamp, 1UL);
+	steps = clamp(elapsed / interval, 1UL, 32UL);
+	pcp->tune_stamp = jiffies;
+	pcp->alloc_rate = mult_frac(pcp->nr_alloc, interval, elapsed);
+	pcp->free_rate = mult_frac(pcp->nr_free, interval, elapsed);
+	pcp->nr_alloc = 0;
+	pcp->nr_free = 0;
+
+	batch = pcp->base_batch;
+	high = pcp->base_high;
+	/* a zero high means no batching is wanted at all, see NOMMU */
+	if (percpu_pagelist_autotune && !percpu_pagelist_fraction && high) {
+		rate = max(pcp->alloc_rate, pcp->free_rate) / PCP_TUNE_TRIPS;
+		high_max = max_t(long, pcp->base_high, zone->present_pages /
+				 (PCP_TUNE_FRACTION * num_online_cpus()));
+		high = clamp_t(long, 6L * rate, pcp->base_high, high_max);
+		if (high < pcp->high) {
+			shrunk = pcp->high;
+			while (steps-- && shrunk > high)
+				shrunk -= max(shrunk / 4, 1);
+			high = max(high, shrunk);
+		}
+		batch = clamp_t(int, high / 6, pcp->base_batch,
+				max(pcp->base_batch, PCP_TUNE_BATCH_MAX));
+		batch = max(1, min(batch, high / 4));
+	}
+	pcp->batch = batch;
+	pcp->high = high;
+
+	/* give back what is over high a batch per zone->lock hold */
+	while ((to_drain = min(pcp->count - pcp->high, pcp->batch)) > 0) {
+		free_pcppages_bulk(zone, to_drain, pcp);
+		pcp->count -= to_drain;
+		pcp->nr_drain++;
+		local_irq_restore(flags);
+		local_irq_save(flags);
+	}
+	tuned = pcp->high > pcp->base_high;
+	local_irq_restore(flags);
+
+	if (tuned && pcp == &this_cpu_ptr(zone->pageset)->pcp)
+		pcp_decay_arm();
+}
+
+/*
+ * Decay the tuned up pagesets of a processor that went idle after a
+ * burst of allocations or frees.  Those the vmstat updater tuned lately
+ * are left to it.
+ */
+static void pcp_decay(struct work_struct *work)
+{
+	struct per_cpu_pages *pcp;
+	struct zone *zone;
+	bool rearm = false;
+
+	for_each_populated_zone(zone) {
+		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		if (!time_before(jiffies, pcp->tune_stamp + sysctl_stat_interval))
+			pcp_autotune(zone, pcp);
+		else if (pcp->high > pcp->base_high)
+			rearm = true;
+	}
+	/* the updater may have tuned it up while this work was pending */
+	if (rearm)
+		pcp_decay_arm();
+}
+
 /*
  * Drain pages of the indicated processor.
  *
@@ -1809,14 +3470,23 @@ void free_hot_cold_page(struct page *page, int cold)
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
+#ifdef CONFIG_CGROUP_PALLOC
+	if (use_palloc) {
+		palloc_pcp_add(pcp, page, migratetype, cold);
+	} else
+#endif
+	{
+		if (cold)
+			list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		else
+			list_add(&page->lru, &pcp->lists[migratetype]);
+		pcp->count++;
+	}
+	pcp->nr_free++;
 	if (pcp->count >= pcp->high) {
 		free_pcppages_bulk(zone, pcp->batch, pcp);
 		pcp->count -= pcp->batch;
+		pcp->nr_drain++;
 	}
 
 out:
@@ -1891,6 +3561,7 @@ int split_free_page(struct page *page)
 		return 0;
 
 	/* Remove page from free list */
+	palloc_index_del(zone, page, order);
 	list_del(&page->lru);
 	zone->free_area[order].nr_free--;
 	rmv_page_order(page);
@@ -1926,34 +3597,65 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	unsigned long flags;
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
-	struct palloc * ph;
-	
-	ph = ph_from_subsys(current->cgroups->subsys[palloc_subsys_id]);
-		
+#ifdef CONFIG_CGROUP_PALLOC
+	struct palloc *ph = NULL;
+	u64 start = 0;
+#endif
+
 again:
-	/* Skip PCP when physically-aware allocation is requested */
-	if (likely(order == 0) && !ph) {
+#ifdef CONFIG_CGROUP_PALLOC
+	/*
+	 * use_palloc is read once, it may be toggled from debugfs at any
+	 * time, and ph is only used under rcu_read_lock(): the group is
+	 * freed after a grace period once its cgroup is removed.
+	 */
+	rcu_read_lock();
+	ph = ACCESS_ONCE(use_palloc) ? palloc_current() : NULL;
+	if (ph)
+		start = local_clock();
+#endif
+	if (likely(order == 0)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
-		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
-			if (unlikely(list_empty(list)))
+#ifdef CONFIG_CGROUP_PALLOC
+		/* physically-aware allocation uses the per-cpu color lists */
+		if (ph) {
+			palloc_ctx_reset();
+			page = NULL;
+			/* the pool holds pages of all of the group's bins */
+			if (ph->reserve && migratetype == MIGRATE_MOVABLE &&
+			    !palloc_policy_colors())
+				page = palloc_reserve_take(ph, zone);
+			if (!page)
+				page = palloc_rmqueue_pcp(zone, pcp,
+							  migratetype, cold);
+			if (unlikely(!page))
 				goto failed;
-		}
+		} else
+#endif
+		{
+			list = &pcp->lists[migratetype];
+			if (list_empty(list)) {
+				pcp->count += rmqueue_bulk(zone, 0,
+						pcp->batch, list,
+						migratetype, cold);
+				pcp->nr_refill++;
+				if (unlikely(list_empty(list)))
+					goto failed;
+			}
 
-		if (cold)
-			page = list_entry(list->prev, struct page, lru);
-		else
-			page = list_entry(list->next, struct page, lru);
+			if (cold)
+				page = list_entry(list->prev, struct page, lru);
+			else
+				page = list_entry(list->next, struct page, lru);
 
-		list_del(&page->lru);
-		pcp->count--;
+			list_del(&page->lru);
+			pcp->count--;
+		}
+		pcp->nr_alloc++;
 	} else {
 		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
 			/*
@@ -1969,6 +3671,10 @@ again:
 			WARN_ON_ONCE(order > 1);
 		}
 		spin_lock_irqsave(&zone->lock, flags);
+#ifdef CONFIG_CGROUP_PALLOC
+		if (ph)
+			palloc_ctx_reset();
+#endif
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
 		if (!page)
@@ -1978,7 +3684,14 @@ again:
 
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
 	zone_statistics(preferred_zone, zone, gfp_flags);
+#ifdef CONFIG_CGROUP_PALLOC
+	if (ph)
+		palloc_account(ph, page, order, start);
+#endif
 	local_irq_restore(flags);
+#ifdef CONFIG_CGROUP_PALLOC
+	rcu_read_unlock();
+#endif
 
 	VM_BUG_ON(bad_range(zone, page));
 	if (prep_new_page(page, order, gfp_flags))
@@ -1986,7 +3699,14 @@ again:
 	return page;
 
 failed:
+#ifdef CONFIG_CGROUP_PALLOC
+	if (ph)
+		palloc_account(ph, NULL, order, start);
+#endif
 	local_irq_restore(flags);
+#ifdef CONFIG_CGROUP_PALLOC
+	rcu_read_unlock();
+#endif
 	return NULL;
 }
 
@@ -2667,6 +4387,7 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order, struct zonelist *zonelist,
 {
 	struct reclaim_state reclaim_state;
 	int progress;
+	u64 start;
 
 	cond_resched();
 
@@ -2677,7 +4398,10 @@ __perform_reclaim(gfp_t gfp_mask, unsigned int order, struct zonelist *zonelist,
 	reclaim_state.reclaimed_slab = 0;
 	current->reclaim_state = &reclaim_state;
 
+	start = local_clock();
 	progress = try_to_free_pages(zonelist, order, gfp_mask, nodemask);
+	count_vm_events(ALLOCSTALL_TIME_US,
+			div_u64(local_clock() - start, NSEC_PER_USEC));
 
 	current->reclaim_state = NULL;
 	lockdep_clear_current_reclaim_state();
@@ -2827,6 +4551,7 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 	bool sync_migration = false;
 	bool deferred_compaction = false;
 	bool contended_compaction = false;
+	int strict_tries = 0;
 
 	/*
 	 * In the slowpath, we sanity check order to avoid ever trying to
@@ -2954,6 +4679,9 @@ rebalance:
 			if ((current->flags & PF_DUMPCORE) &&
 			    !(gfp_mask & __GFP_NOFAIL))
 				goto nopage;
+			/* no OOM kill while pages outside the bins are free */
+			if (palloc_strict_give_up(order, &strict_tries, 1))
+				goto rebalance;
 			page = __alloc_pages_may_oom(gfp_mask, order,
 					zonelist, high_zoneidx,
 					nodemask, preferred_zone,
@@ -2988,7 +4716,8 @@ rebalance:
 	if (should_alloc_retry(gfp_mask, order, did_some_progress,
 						pages_reclaimed)) {
 		/* Wait for some write requests to complete then retry */
-		wait_iff_congested(preferred_zone, BLK_RW_ASYNC, HZ/50);
+		if (!palloc_strict_give_up(order, &strict_tries, 0))
+			wait_iff_congested(preferred_zone, BLK_RW_ASYNC, HZ/50);
 		goto rebalance;
 	} else {
 		/*
@@ -3009,9 +4738,11 @@ rebalance:
 	}
 
 nopage:
+	palloc_strict_done(strict_tries);
 	warn_alloc_failed(gfp_mask, order, NULL);
 	return page;
 got_pg:
+	palloc_strict_done(strict_tries);
 	if (kmemcheck_enabled)
 		kmemcheck_pagealloc_alloc(page, order, gfp_mask);
 
@@ -3083,6 +4814,209 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+#ifdef CONFIG_CGROUP_PALLOC
+/*
+ * Take up to nr order-0 pages in the bins of ph onto list, from the
+ * per-cpu color lists first and then from the color cache under a
+ * single hold of zone->lock. There is no fallback to other colors.
+ * Called with interrupts disabled, returns the number of pages taken.
+ */
+static unsigned long palloc_rmqueue_bulk(struct zone *zone,
+					 struct per_cpu_pages *pcp,
+					 struct palloc *ph, unsigned long nr,
+					 int migratetype, int cold,
+					 struct list_head *list)
+{
+	unsigned long i, got = 0;
+	COLOR_BITMAP(tmpcmap);
+	unsigned long *cmap;
+	struct page *page;
+	u64 start;
+	int iters;
+
+	cmap = palloc_cmap(ph, tmpcmap);
+	start = local_clock();
+	while (got < nr) {
+		palloc_ctx_reset();
+		page = palloc_pcp_find(pcp, ph, cmap, migratetype, cold);
+		if (!page)
+			break;
+		palloc_account(ph, page, 0, start);
+		list_add_tail(&page->lru, list);
+		got++;
+	}
+	if (got < nr) {
+		spin_lock(&zone->lock);
+		pcp->nr_refill++;
+		for (i = 0; got + i < nr; i++) {
+			palloc_ctx_reset();
+			iters = 0;
+			page = palloc_rmqueue_color(zone, migratetype, ph, cmap,
+						    &palloc.stat[0], &iters);
+			if (!page)
+				break;
+			palloc_account(ph, page, 0, start);
+			list_add_tail(&page->lru, list);
+		}
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -i);
+		spin_unlock(&zone->lock);
+		got += i;
+	}
+	return got;
+}
+#endif
+
+/*
+ * The fast path of alloc_pages_bulk(): take up to nr order-0 pages onto
+ * list from the per-cpu list of the first zone of the local node that
+ * the cpuset allows and that stays above its low watermark once they
+ * are gone, then refill from the buddy lists of that zone under a
+ * single hold of zone->lock. With PALLOC on, the pages are taken in the
+ * bins of the current task's group. There is no reclaim and no memory
+ * policy. Returns the number of pages put on list.
+ */
+static unsigned long __alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr,
+					struct list_head *list)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	struct zone *preferred_zone, *zone;
+	unsigned int cpuset_mems_cookie;
+	struct zonelist *zonelist;
+	struct per_cpu_pages *pcp;
+	struct list_head *pcp_list;
+	struct page *page, *next;
+	unsigned long flags, i, got = 0;
+	struct zoneref *z;
+	LIST_HEAD(pages);
+
+	gfp_mask &= gfp_allowed_mask;
+	if (!nr || should_fail_alloc_page(gfp_mask, 0))
+		return 0;
+#ifdef CONFIG_NUMA
+	/* the policy picks the node of each page */
+	if (current->mempolicy)
+		return 0;
+#endif
+
+	cpuset_mems_cookie = get_mems_allowed();
+	zonelist = node_zonelist(numa_node_id(), gfp_mask);
+	first_zones_zonelist(zonelist, high_zoneidx,
+			     &cpuset_current_mems_allowed, &preferred_zone);
+	if (!preferred_zone)
+		goto out;
+	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
+					&cpuset_current_mems_allowed) {
+		if (zone_watermark_ok(zone, 0, low_wmark_pages(zone) + nr,
+				      zone_idx(preferred_zone), 0))
+			break;
+	}
+	if (!zone)
+		goto out;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+#ifdef CONFIG_CGROUP_PALLOC
+	if (use_palloc) {
+		got = palloc_rmqueue_bulk(zone, pcp, palloc_current(), nr,
+					  migratetype, cold, &pages);
+	} else
+#endif
+	{
+		pcp_list = &pcp->lists[migratetype];
+		while (got < nr && !list_empty(pcp_list)) {
+			if (cold)
+				page = list_entry(pcp_list->prev, struct page,
+						  lru);
+			else
+				page = list_entry(pcp_list->next, struct page,
+						  lru);
+			list_move_tail(&page->lru, &pages);
+			pcp->count--;
+			got++;
+		}
+		if (got < nr) {
+			got += rmqueue_bulk(zone, 0, nr - got, &pages,
+					    migratetype, cold);
+			pcp->nr_refill++;
+		}
+	}
+	pcp->nr_alloc += got;
+	__count_zone_vm_events(PGALLOC, zone, got);
+	for (i = 0; i < got; i++)
+		zone_statistics(preferred_zone, zone, gfp_mask);
+	local_irq_restore(flags);
+
+	got = 0;
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		VM_BUG_ON(bad_range(zone, page));
+		/* a bad page is left alone, as by buffered_rmqueue() */
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		list_add_tail(&page->lru, list);
+		got++;
+	}
+out:
+	put_mems_allowed(cpuset_mems_cookie);
+	return got;
+}
+
+/**
+ * alloc_pages_bulk - allocate a number of order-0 pages at once
+ * @gfp_mask: GFP flags of the allocation
+ * @nr: number of pages wanted
+ * @list: list to add the pages to, linked through page->lru
+ *
+ * Saves callers allocating pages in a loop a zone->lock round trip per
+ * per-cpu list refill. Fewer than @nr pages may be returned; if none
+ * can be had without reclaim, a single page is allocated the usual way,
+ * so that a caller retrying until it has all of its pages makes
+ * progress. Returns the number of pages added to @list.
+ */
+unsigned long alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr,
+			       struct list_head *list)
+{
+	struct page *page;
+	unsigned long got;
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	got = __alloc_pages_bulk(gfp_mask, nr, list);
+	if (got || !nr)
+		return got;
+
+	page = alloc_page(gfp_mask);
+	if (!page)
+		return 0;
+	list_add_tail(&page->lru, list);
+	return 1;
+}
+EXPORT_SYMBOL(alloc_pages_bulk);
+
+#ifdef CONFIG_CGROUP_PALLOC
+/*
+ * Allocate up to nr order-0 pages in the bins of ph (NULL: the current
+ * task's group) onto list, see __alloc_pages_bulk(). The caller
+ * allocates the pages it did not get one by one. Returns the number of
+ * pages put on list.
+ */
+unsigned long palloc_alloc_pages_bulk(struct palloc *ph, gfp_t gfp_mask,
+				      unsigned long nr, struct list_head *list)
+{
+	struct palloc *old;
+
+	if (!use_palloc)
+		return 0;
+
+	old = palloc_set_current(ph);
+	nr = __alloc_pages_bulk(gfp_mask, nr, list);
+	palloc_set_current(old);
+	return nr;
+}
+#endif /* CONFIG_CGROUP_PALLOC */
+
 /*
  * Common helper functions.
  */
@@ -4298,8 +6232,11 @@ static void __meminit zone_init_free_lists(struct zone *zone)
 	int c;
 	for (c = 0; c < MAX_PALLOC_BINS; c++) {
 		INIT_LIST_HEAD(&zone->color_list[c]);
+		zone->color_nr[c] = 0;
 	}
 	bitmap_zero(zone->color_bitmap, MAX_PALLOC_BINS);
+	bitmap_zero(zone->color_used, MAX_PALLOC_BINS);
+	zone->color_cfg = NULL;
 #endif /* CONFIG_CGROUP_PALLOC */
 
 	for_each_migratetype_order(order, t) {
@@ -4367,6 +6304,9 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
 	int migratetype;
+#ifdef CONFIG_CGROUP_PALLOC
+	int color;
+#endif
 
 	memset(p, 0, sizeof(*p));
 
@@ -4374,8 +6314,16 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
+	pcp->base_high = pcp->high;
+	pcp->base_batch = pcp->batch;
+	pcp->tune_stamp = jiffies;
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+#ifdef CONFIG_CGROUP_PALLOC
+	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
+		for (color = 0; color < MAX_PALLOC_BINS; color++)
+			INIT_LIST_HEAD(&pcp->color_lists[migratetype][color]);
+#endif
 }
 
 /*
@@ -4393,6 +6341,8 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
+	pcp->base_high = pcp->high;
+	pcp->base_batch = pcp->batch;
 }
 
 static void __meminit setup_zone_pageset(struct zone *zone)
@@ -4420,9 +6370,12 @@ static void __meminit setup_zone_pageset(struct zone *zone)
 void __init setup_per_cpu_pageset(void)
 {
 	struct zone *zone;
+	int cpu;
 
 	for_each_populated_zone(zone)
 		setup_zone_pageset(zone);
+	for_each_possible_cpu(cpu)
+		INIT_DELAYED_WORK(&per_cpu(pcp_decay_work, cpu), pcp_decay);
 }
 
 static noinline __init_refok
@@ -4890,11 +6843,17 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	enum zone_type j;
 	int nid = pgdat->node_id;
 	unsigned long zone_start_pfn = pgdat->node_start_pfn;
-	int ret;
+	int ret, i;
 
 	pgdat_resize_init(pgdat);
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	init_waitqueue_head(&pgdat->pfmemalloc_wait);
+#ifdef CONFIG_CGROUP_PALLOC
+	init_waitqueue_head(&pgdat->kcolord_wait);
+#endif
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat_page_cgroup_init(pgdat);
 
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -4949,7 +6908,8 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 		zone->name = zone_names[j];
 		spin_lock_init(&zone->lock);
-		spin_lock_init(&zone->lru_lock);
+		for (i = 0; i < NR_LRU_LOCKS; i++)
+			spin_lock_init(&zone->lru_locks[i].lock);
 		zone_seqlock_init(zone);
 		zone->zone_pgdat = pgdat;
 
@@ -5015,7 +6975,7 @@ void __paginginit free_area_init_node(int nid, unsigned long *zones_size,
 	pg_data_t *pgdat = NODE_DATA(nid);
 
 	/* pg_data_t should be reset to zero when it's allocated */
-	WARN_ON(pgdat->nr_zones || pgdat->classzone_idx);
+	WARN_ON(pgdat->nr_zones || pgdat->kswapd_req[0].classzone_idx);
 
 	pgdat->node_id = nid;
 	pgdat->node_start_pfn = node_start_pfn;
@@ -5464,6 +7424,7 @@ static int page_alloc_cpu_notify(struct notifier_block *self,
 	int cpu = (unsigned long)hcpu;
 
 	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		cancel_delayed_work_sync(&per_cpu(pcp_decay_work, cpu));
 		lru_add_drain_cpu(cpu);
 		drain_pages(cpu);
 
@@ -6434,6 +8395,7 @@ __offline_isolated_pages(unsigned long start_pfn, unsigned long end_pfn)
 		printk(KERN_INFO "remove from free list %lx %d %lx\n",
 		       pfn, 1 << order, end_pfn);
 #endif
+		palloc_index_del(zone, page, order);
 		list_del(&page->lru);
 		rmv_page_order(page);
 		zone->free_area[order].nr_free--;
@@ -6506,6 +8468,11 @@ static const struct trace_print_flags pageflag_names[] = {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	{1UL << PG_compound_lock,	"compound_lock"	},
 #endif
+#ifdef CONFIG_LRU_GEN
+	{1UL << PG_lru_gen,		"lru_gen0"	},
+	{1UL << (PG_lru_gen + 1),	"lru_gen1"	},
+	{1UL << (PG_lru_gen + 2),	"lru_gen2"	},
+#endif
 };
 
 static void dump_page_flags(unsigned long flags)
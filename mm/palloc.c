@@ -14,6 +14,21 @@
 #include <linux/fs.h>
 #include <linux/bitmap.h>
 #include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/swap.h>
+#include <linux/ksm.h>
+#include <linux/migrate.h>
+#include <linux/hrtimer.h>
+#include <linux/mm_inline.h>
+#include <linux/seq_file.h>
+#include <linux/irq_work.h>
+#include <linux/pagemap.h>
+#include <linux/cpuset.h>
+#include "internal.h"
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/palloc.h>
 
 /*
  * Check if a page is compliant to the policy defined for the given vma
@@ -21,12 +36,30 @@
 #ifdef CONFIG_CGROUP_PALLOC
 
 #define MAX_LINE_LEN (6*128)
+
+/* max. number of pages isolated per migrate_pages() call */
+#define RECOLOR_BATCH 32
+
 /*
  * Types of files in a palloc group
  * FILE_PALLOC - contain list of palloc bins allowed
+ * FILE_CACHE_BINS - contain list of cache colors allowed
+ * FILE_BANK_BINS - contain list of banks allowed
+ * FILE_EFFECTIVE - bins used by the allocator (read-only)
+ * FILE_MIGRATE - migrate resident pages when the bins change
+ * FILE_MIGRATE_RATE - recoloring rate limit in pages per second
+ * FILE_RESERVE - number of free pages to keep pinned in the bins
+ * FILE_EXCLUSIVE - siblings may not share the bins
 */
 typedef enum {
 	FILE_PALLOC,
+	FILE_CACHE_BINS,
+	FILE_BANK_BINS,
+	FILE_EFFECTIVE,
+	FILE_MIGRATE,
+	FILE_MIGRATE_RATE,
+	FILE_RESERVE,
+	FILE_EXCLUSIVE,
 } palloc_filetype_t;
 
 /*
@@ -48,6 +81,734 @@ struct palloc * ph_from_subsys(struct cgroup_subsys_state * subsys)
 	return container_of(subsys, struct palloc, css);
 }
 
+struct palloc *palloc_owner_group(u32 owner)
+{
+	struct cgroup_subsys_state *css;
+	struct palloc *ph;
+
+	css = css_lookup(&palloc_subsys, owner >> 16);
+	if (!css)
+		return NULL;
+	ph = ph_from_subsys(css);
+	return palloc_owner(ph) == owner ? ph : NULL;
+}
+
+struct palloc *palloc_top(void)
+{
+	return &top_palloc;
+}
+
+struct palloc *palloc_get_mm_group(struct mm_struct *mm)
+{
+	struct task_struct *p;
+	struct palloc *ph = NULL;
+
+	rcu_read_lock();
+	p = rcu_dereference(mm->owner);
+	if (p) {
+		ph = ph_from_subsys(task_subsys_state(p, palloc_subsys_id));
+		if (!css_tryget(&ph->css))
+			ph = NULL;
+	}
+	rcu_read_unlock();
+	return ph;
+}
+
+/*
+ * The page cache of a file is allocated in the bins of the first group
+ * below the root to populate it, whoever reads it in later: a kworker
+ * doing readahead or writeback, or a task of another group. A mapping
+ * whose owner is gone is taken over by the next group allocating for it.
+ */
+struct palloc *palloc_get_mapping_group(struct address_space *mapping)
+{
+	struct palloc *ph;
+	u32 owner;
+
+	if (!palloc_enabled() || in_interrupt())
+		return NULL;
+
+	rcu_read_lock();
+	owner = ACCESS_ONCE(mapping->palloc_owner);
+	ph = owner ? palloc_owner_group(owner) : NULL;
+	if (!ph) {
+		ph = current->palloc ? :
+			ph_from_subsys(task_subsys_state(current,
+							 palloc_subsys_id));
+		if (ph != &top_palloc)
+			cmpxchg(&mapping->palloc_owner, owner,
+				palloc_owner(ph));
+	}
+	if (!css_tryget(&ph->css))
+		ph = NULL;
+	rcu_read_unlock();
+	return ph;
+}
+
+struct page *__page_cache_alloc_mapping(struct address_space *mapping,
+					gfp_t gfp)
+{
+	struct palloc *ph, *old;
+	struct page *page;
+
+	ph = palloc_get_mapping_group(mapping);
+	if (!ph)
+		return __page_cache_alloc(gfp);
+	old = palloc_set_current(ph);
+	page = __page_cache_alloc(gfp);
+	palloc_set_current(old);
+	palloc_put_group(ph);
+	return page;
+}
+EXPORT_SYMBOL(__page_cache_alloc_mapping);
+
+/*
+ * Allocate up to nr pages for the page cache of mapping at once, see
+ * palloc_alloc_pages_bulk(). Page cache spread over the nodes of a
+ * cpuset is allocated one page at a time.
+ */
+unsigned long __page_cache_alloc_bulk(struct address_space *mapping,
+				      gfp_t gfp, unsigned long nr,
+				      struct list_head *list)
+{
+	struct palloc *ph;
+
+	if (cpuset_do_page_mem_spread())
+		return 0;
+
+	ph = palloc_get_mapping_group(mapping);
+	if (!ph)
+		return 0;
+	nr = palloc_alloc_pages_bulk(ph, gfp, nr, list);
+	palloc_put_group(ph);
+	return nr;
+}
+
+/*
+ * Recoloring: when the bins of a group with 'migrate' set change, the
+ * group is queued for kpallocd, which moves the pages mapped by its tasks
+ * that are outside of the new bins into them.
+ */
+static LIST_HEAD(recolor_list);
+static DEFINE_SPINLOCK(recolor_lock);
+static DECLARE_WAIT_QUEUE_HEAD(recolor_wait);
+
+static void palloc_queue_recolor(struct palloc *ph)
+{
+	spin_lock(&recolor_lock);
+	if (list_empty(&ph->recolor_node))
+		list_add_tail(&ph->recolor_node, &recolor_list);
+	spin_unlock(&recolor_lock);
+	wake_up(&recolor_wait);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge page covers all the colors of a block. Once split, the pages of
+ * one that lies outside of the bins of the group it was allocated for,
+ * e.g. by a fault or khugepaged falling back, are recolored like after a
+ * rebin, if the group migrates on rebin.
+ */
+void palloc_split_huge_page(struct page *page)
+{
+	struct palloc *ph;
+
+	if (!palloc_enabled())
+		return;
+	rcu_read_lock();
+	ph = palloc_page_group(page);
+	/* the reference keeps palloc_destroy() off the recolor list */
+	if (ph && (!ph->migrate || !css_tryget(&ph->css)))
+		ph = NULL;
+	rcu_read_unlock();
+	if (!ph)
+		return;
+	if (!palloc_block_fits(ph, page, HPAGE_PMD_ORDER))
+		palloc_queue_recolor(ph);
+	css_put(&ph->css);
+}
+#endif
+
+/*
+ * Reserve pools are refilled by kpallocd as well, from a list that the
+ * allocator queues to with interrupts disabled. kpallocd is woken from
+ * an irq_work, since the allocator may hold any lock.
+ */
+static LIST_HEAD(reserve_list);
+static DEFINE_SPINLOCK(reserve_lock);
+
+static void palloc_refill_wake(struct irq_work *work)
+{
+	wake_up(&recolor_wait);
+}
+
+static struct irq_work palloc_refill_work = {
+	.func = palloc_refill_wake,
+};
+
+void palloc_queue_refill(struct palloc *ph)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&reserve_lock, flags);
+	if (list_empty(&ph->reserve_node))
+		list_add_tail(&ph->reserve_node, &reserve_list);
+	spin_unlock_irqrestore(&reserve_lock, flags);
+	irq_work_queue(&palloc_refill_work);
+}
+
+/* refill the queued reserve pools */
+static void palloc_refill_pools(void)
+{
+	struct palloc *ph;
+
+	for (;;) {
+		ph = NULL;
+		spin_lock_irq(&reserve_lock);
+		if (!list_empty(&reserve_list)) {
+			ph = list_first_entry(&reserve_list, struct palloc,
+					      reserve_node);
+			list_del_init(&ph->reserve_node);
+			if (!css_tryget(&ph->css))
+				ph = NULL;
+		}
+		spin_unlock_irq(&reserve_lock);
+		if (!ph)
+			break;
+		palloc_reserve_fill(ph);
+		css_put(&ph->css);
+	}
+}
+
+static struct page *palloc_new_page(struct page *page, unsigned long private,
+				    int **result)
+{
+	struct palloc *ph = (struct palloc *)private;
+	struct page *newpage;
+
+	/* kpallocd allocates from ph's bins, see palloc_recolor() */
+	newpage = alloc_pages_exact_node(page_to_nid(page),
+					 GFP_HIGHUSER_MOVABLE | GFP_THISNODE, 0);
+	if (newpage && !test_bit(palloc_page_color(newpage), ph->cmap)) {
+		/* the allocator fell back to a color outside of the bins */
+		__free_page(newpage);
+		newpage = NULL;
+	}
+	return newpage;
+}
+
+struct palloc_isolate {
+	struct palloc *ph;
+	struct vm_area_struct *vma;
+	struct list_head *pagelist;
+	unsigned long next;		/* where to resume the walk */
+	int nr;
+};
+
+/* isolate the out-of-bin pages mapped by the ptes of pmd */
+static int palloc_isolate_pmd(pmd_t *pmd, unsigned long addr,
+			      unsigned long end, struct mm_walk *walk)
+{
+	struct palloc_isolate *args = walk->private;
+	struct palloc *ph = args->ph;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	/* recolored a base page at a time, like FOLL_SPLIT did */
+	split_huge_page_pmd(walk->mm, pmd);
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end && args->nr < RECOLOR_BATCH;
+	     pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(args->vma, addr, *pte);
+		if (!page)
+			continue;
+		ph->nr_scanned++;
+		/* leave shared pages where they are */
+		if (PageReserved(page) || PageKsm(page) ||
+		    page_mapcount(page) > 1 ||
+		    test_bit(palloc_page_color(page), ph->cmap) ||
+		    isolate_lru_page(page))
+			continue;
+		list_add_tail(&page->lru, args->pagelist);
+		inc_zone_page_state(page, NR_ISOLATED_ANON +
+				    page_is_file_cache(page));
+		args->nr++;
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	args->next = addr;
+	cond_resched();
+	/* a positive return ends walk_page_range() */
+	return args->nr >= RECOLOR_BATCH;
+}
+
+/*
+ * Isolate up to RECOLOR_BATCH out-of-bin pages mapped in mm, starting at
+ * *start. On return *start is where to resume, or ULONG_MAX at the end.
+ * Only populated page tables are walked. mm->mmap_sem must be held for
+ * read.
+ */
+static int palloc_isolate_pages(struct palloc *ph, struct mm_struct *mm,
+				unsigned long *start,
+				struct list_head *pagelist)
+{
+	struct palloc_isolate args = {
+		.ph		= ph,
+		.pagelist	= pagelist,
+	};
+	struct mm_walk walk = {
+		.pmd_entry	= palloc_isolate_pmd,
+		.mm		= mm,
+		.private	= &args,
+	};
+	struct vm_area_struct *vma;
+
+	for (vma = find_vma(mm, *start); vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_IO|VM_HUGETLB|VM_PFNMAP|VM_RESERVED))
+			continue;
+		args.vma = vma;
+		if (walk_page_range(max(*start, vma->vm_start), vma->vm_end,
+				    &walk) > 0) {
+			*start = args.next;
+			return args.nr;
+		}
+	}
+	*start = ULONG_MAX;
+	return args.nr;
+}
+
+/*
+ * Isolate a batch under mmap_sem, then migrate it with mmap_sem dropped:
+ * the isolated pages hold a reference, and the walk resumes at an
+ * address, which stays meaningful if the mappings change meanwhile.
+ */
+static void palloc_recolor_mm(struct palloc *ph, struct mm_struct *mm)
+{
+	unsigned long addr = 0;
+	LIST_HEAD(pagelist);
+	struct page *page;
+	int nr, left, rc;
+	u64 rate;
+
+	while (addr != ULONG_MAX && ACCESS_ONCE(ph->migrate) &&
+	       !kthread_should_stop()) {
+		down_read(&mm->mmap_sem);
+		nr = palloc_isolate_pages(ph, mm, &addr, &pagelist);
+		up_read(&mm->mmap_sem);
+		if (nr) {
+			rc = migrate_pages(&pagelist, palloc_new_page,
+					   (unsigned long)ph, false,
+					   MIGRATE_SYNC);
+			left = 0;
+			list_for_each_entry(page, &pagelist, lru)
+				left++;
+			if (rc > 0)
+				left = max(left, rc);
+			putback_lru_pages(&pagelist);
+			ph->nr_migrated += nr - left;
+			ph->nr_failed += left;
+		}
+
+		rate = ACCESS_ONCE(ph->migrate_rate);
+		if (nr && rate)
+			schedule_timeout_interruptible(
+				div64_u64((u64)nr * HZ + rate - 1, rate));
+	}
+}
+
+static void palloc_recolor_task(struct task_struct *p,
+				struct cgroup_scanner *scan)
+{
+	struct mm_struct *mm = get_task_mm(p);
+
+	if (!mm)
+		return;
+	palloc_recolor_mm(scan->data, mm);
+	mmput(mm);
+}
+
+/* threads share the mm of their group leader */
+static int palloc_test_leader(struct task_struct *p,
+			      struct cgroup_scanner *scan)
+{
+	return thread_group_leader(p);
+}
+
+static void palloc_recolor(struct palloc *ph)
+{
+	struct cgroup_scanner scan;
+	struct palloc *old;
+	ktime_t start;
+
+	/* an empty bin list means no restriction */
+	if (!ph->nr_cmap)
+		return;
+
+	start = ktime_get();
+	old = palloc_set_current(ph);
+
+	scan.cg = ph->css.cgroup;
+	scan.test_task = palloc_test_leader;
+	scan.process_task = palloc_recolor_task;
+	scan.heap = NULL;
+	scan.data = ph;
+	cgroup_scan_tasks(&scan);
+
+	palloc_set_current(old);
+	ph->migrate_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int kpallocd(void *unused)
+{
+	struct palloc *ph;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(recolor_wait,
+				     !list_empty(&recolor_list) ||
+				     !list_empty(&reserve_list) ||
+				     kthread_should_stop());
+
+		/* refills first, they are short and latency sensitive */
+		palloc_refill_pools();
+
+		ph = NULL;
+		spin_lock(&recolor_lock);
+		if (!list_empty(&recolor_list)) {
+			ph = list_first_entry(&recolor_list, struct palloc,
+					      recolor_node);
+			list_del_init(&ph->recolor_node);
+			if (!css_tryget(&ph->css))
+				ph = NULL;
+		}
+		spin_unlock(&recolor_lock);
+
+		if (ph) {
+			palloc_recolor(ph);
+			css_put(&ph->css);
+		}
+	}
+	return 0;
+}
+
+static int __init palloc_recolor_init(void)
+{
+	struct task_struct *tsk;
+
+	tsk = kthread_run(kpallocd, NULL, "kpallocd");
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	return 0;
+}
+late_initcall(palloc_recolor_init);
+
+/* number of cache colors and banks */
+static inline int palloc_cache_bins(void)
+{
+	return 1 << hweight32(palloc_cache_mask());
+}
+
+static inline int palloc_bank_bins(void)
+{
+	return palloc_bins() / palloc_cache_bins();
+}
+
+/* gather the bits of color selected by mask into a dense index */
+static inline int palloc_color_index(int color, int mask)
+{
+	int i, bit = 0, idx = 0;
+
+	for (i = 0; i < MAX_PALLOC_BITS; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		if (color & (1 << i))
+			idx |= (1 << bit);
+		bit++;
+	}
+	return idx;
+}
+
+/*
+ * Fill cmap with the colors the maps of ph allow: a color is usable if
+ * it is in bins, its cache color in cache_bins and its bank in bank_bins;
+ * an empty map does not restrict. Return 1 if the maps restrict, 0 if
+ * they do not and -EINVAL if they leave no usable color.
+ */
+static int palloc_own_cmap(struct palloc *ph, unsigned long *cmap)
+{
+	int nr = palloc_bins();
+	int cmask = palloc_cache_mask();
+	int bmask = ~cmask & (nr - 1);
+	int use_bins = !bitmap_empty(ph->bins, nr);
+	int use_cache = !bitmap_empty(ph->cache_bins, palloc_cache_bins());
+	int use_bank = !bitmap_empty(ph->bank_bins, palloc_bank_bins());
+	int c;
+
+	bitmap_zero(cmap, MAX_PALLOC_BINS);
+	if (!use_bins && !use_cache && !use_bank)
+		return 0;
+	for (c = 0; c < nr; c++) {
+		if (use_bins && !test_bit(c, ph->bins))
+			continue;
+		if (use_cache &&
+		    !test_bit(palloc_color_index(c, cmask), ph->cache_bins))
+			continue;
+		if (use_bank &&
+		    !test_bit(palloc_color_index(c, bmask), ph->bank_bins))
+			continue;
+		__set_bit(c, cmap);
+	}
+	return bitmap_empty(cmap, MAX_PALLOC_BINS) ? -EINVAL : 1;
+}
+
+/* whether ph restricts its colors itself rather than inheriting them */
+static inline int palloc_has_own_bins(struct palloc *ph)
+{
+	return !bitmap_empty(ph->bins, palloc_bins()) ||
+		!bitmap_empty(ph->cache_bins, palloc_cache_bins()) ||
+		!bitmap_empty(ph->bank_bins, palloc_bank_bins());
+}
+
+static inline struct palloc *palloc_parent(struct palloc *ph)
+{
+	struct cgroup *parent = ph->css.cgroup->parent;
+
+	return parent ? cgroup_ph(parent) : NULL;
+}
+
+/*
+ * Compute into cmap the bins of ph, a child of parent (NULL for the
+ * root). Own maps must select a subset of the parent's bins, or with
+ * strict unset, as after a color configuration change, are cut down to
+ * them. A group without own maps, or whose maps were cut to nothing,
+ * inherits the parent's bins less those of its exclusive siblings, or
+ * all of the parent's if the exclusive siblings hold them all.
+ */
+static int palloc_effective_cmap(struct palloc *ph, struct palloc *parent,
+				 unsigned long *cmap, bool strict)
+{
+	struct cgroup *pos;
+	struct palloc *sib;
+	int ret;
+
+	ret = palloc_own_cmap(ph, cmap);
+	if (ret < 0)
+		return ret;
+	if (!parent)
+		return 0;
+	if (ret) {
+		if (!parent->nr_cmap ||
+		    bitmap_subset(cmap, parent->cmap, MAX_PALLOC_BINS))
+			return 0;
+		if (strict)
+			return -EINVAL;
+		if (bitmap_and(cmap, cmap, parent->cmap, MAX_PALLOC_BINS))
+			return 0;
+	}
+
+	bitmap_zero(cmap, MAX_PALLOC_BINS);
+	if (parent->nr_cmap)
+		bitmap_copy(cmap, parent->cmap, MAX_PALLOC_BINS);
+	else
+		bitmap_set(cmap, 0, palloc_bins());
+	list_for_each_entry(pos, &parent->css.cgroup->children, sibling) {
+		sib = cgroup_ph(pos);
+		if (sib != ph && sib->exclusive)
+			bitmap_andnot(cmap, cmap, sib->cmap, MAX_PALLOC_BINS);
+	}
+	if (bitmap_empty(cmap, MAX_PALLOC_BINS))
+		bitmap_copy(cmap, parent->cmap, MAX_PALLOC_BINS);
+	else if (!parent->nr_cmap && bitmap_full(cmap, palloc_bins()))
+		/* all colors: no restriction */
+		bitmap_zero(cmap, MAX_PALLOC_BINS);
+	return 0;
+}
+
+/*
+ * Check that the bins cmap of ph keep to the hierarchy: the own maps of
+ * its children select a subset of them, and they share no color with
+ * the own maps of a sibling if either of the two is exclusive.
+ */
+static int palloc_check_cmap(struct palloc *ph, const unsigned long *cmap,
+			     int exclusive)
+{
+	struct cgroup *cgrp = ph->css.cgroup, *pos;
+	struct palloc *p;
+
+	if (!bitmap_empty(cmap, MAX_PALLOC_BINS)) {
+		list_for_each_entry(pos, &cgrp->children, sibling) {
+			p = cgroup_ph(pos);
+			if (palloc_has_own_bins(p) &&
+			    !bitmap_subset(p->cmap, cmap, MAX_PALLOC_BINS))
+				return -EINVAL;
+		}
+	}
+	if (!cgrp->parent)
+		return 0;
+	list_for_each_entry(pos, &cgrp->parent->children, sibling) {
+		p = cgroup_ph(pos);
+		if (p == ph || !(exclusive || p->exclusive) ||
+		    !palloc_has_own_bins(p))
+			continue;
+		if (bitmap_intersects(cmap, p->cmap, MAX_PALLOC_BINS))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * The allocator only reads ph->cmap and ph->nr_cmap, they are set here
+ * with cgroup_mutex held. Pages allocated or pooled for the old bins
+ * are recolored and drained.
+ */
+static void palloc_set_cmap(struct palloc *ph, const unsigned long *cmap)
+{
+	unsigned long flags;
+
+	if (bitmap_equal(cmap, ph->cmap, MAX_PALLOC_BINS))
+		return;
+
+	spin_lock_irqsave(&ph->lock, flags);
+	bitmap_copy(ph->cmap, cmap, MAX_PALLOC_BINS);
+	ph->nr_cmap = bitmap_weight(cmap, MAX_PALLOC_BINS);
+	spin_unlock_irqrestore(&ph->lock, flags);
+
+	if (ph->migrate)
+		palloc_queue_recolor(ph);
+	if (ph->nr_pool) {
+		/* the pool may hold pages outside of the new bins */
+		palloc_reserve_drain(ph, 0);
+		palloc_queue_refill(ph);
+	}
+}
+
+/* next group after pos in a pre-order walk of the groups below root */
+static struct cgroup *palloc_next_descendant(struct cgroup *pos,
+					     struct cgroup *root)
+{
+	if (!list_empty(&pos->children))
+		return list_first_entry(&pos->children, struct cgroup, sibling);
+	for (; pos != root; pos = pos->parent) {
+		if (pos->sibling.next != &pos->parent->children)
+			return list_entry(pos->sibling.next, struct cgroup,
+					  sibling);
+	}
+	return NULL;
+}
+
+/* recompute the bins of ph from its maps and parent, keep them on error */
+static void palloc_refresh_cmap(struct palloc *ph)
+{
+	COLOR_BITMAP(cmap);
+
+	if (!palloc_effective_cmap(ph, palloc_parent(ph), cmap, false))
+		palloc_set_cmap(ph, cmap);
+}
+
+/*
+ * Recompute the bins of the groups below root other than skip, parents
+ * before their children, which inherit from them.
+ */
+static void palloc_refresh_subtree(struct cgroup *root, struct palloc *skip)
+{
+	struct cgroup *pos = root;
+
+	while ((pos = palloc_next_descendant(pos, root))) {
+		if (cgroup_ph(pos) != skip)
+			palloc_refresh_cmap(cgroup_ph(pos));
+	}
+}
+
+/*
+ * Recompute the bins of ph after its maps changed and pass them on to
+ * the groups inheriting from it or its parent. Return -EINVAL, leaving
+ * the bins alone, if the maps leave no usable color or break the rules
+ * of palloc_check_cmap().
+ */
+static int palloc_update_cmap(struct palloc *ph)
+{
+	struct palloc *parent = palloc_parent(ph);
+	COLOR_BITMAP(cmap);
+	int ret;
+
+	if (ph->exclusive && !palloc_has_own_bins(ph))
+		return -EINVAL;
+	ret = palloc_effective_cmap(ph, parent, cmap, true);
+	if (!ret)
+		ret = palloc_check_cmap(ph, cmap, ph->exclusive);
+	if (ret)
+		return ret;
+
+	palloc_set_cmap(ph, cmap);
+	palloc_refresh_subtree(parent ? parent->css.cgroup : ph->css.cgroup,
+			       ph);
+	return 0;
+}
+
+/*
+ * Make the bins of ph exclusive among its siblings, which must not hold
+ * any of them, or share them again. Siblings inheriting the parent's
+ * bins lose or regain them.
+ */
+static int palloc_set_exclusive(struct palloc *ph, int exclusive)
+{
+	struct palloc *parent = palloc_parent(ph);
+	int ret;
+
+	if (exclusive == ph->exclusive)
+		return 0;
+	if (exclusive) {
+		if (!parent || !palloc_has_own_bins(ph))
+			return -EINVAL;
+		ret = palloc_check_cmap(ph, ph->cmap, 1);
+		if (ret)
+			return ret;
+	}
+	ph->exclusive = exclusive;
+	palloc_refresh_subtree(parent->css.cgroup, ph);
+	return 0;
+}
+
+/*
+ * Recompute the bins of all groups, the colors having changed. Groups
+ * whose bins changed are recolored.
+ */
+void palloc_rebuild_cmaps(void)
+{
+	struct cgroup *root = top_palloc.css.cgroup;
+
+	cgroup_lock();
+	palloc_refresh_cmap(&top_palloc);
+	palloc_refresh_subtree(root, NULL);
+	cgroup_unlock();
+}
+
+/*
+ * Pooled pages are only given out while palloc is on, so give them back
+ * when it is turned off, and refill the pools when it is turned on.
+ */
+void palloc_reserve_toggled(void)
+{
+	struct cgroup *root = top_palloc.css.cgroup;
+	struct cgroup *pos = root;
+	struct palloc *ph;
+
+	cgroup_lock();
+	do {
+		ph = cgroup_ph(pos);
+		if (!palloc_enabled())
+			palloc_reserve_drain(ph, 0);
+		else if (ph->reserve)
+			palloc_queue_refill(ph);
+	} while ((pos = palloc_next_descendant(pos, root)));
+	cgroup_unlock();
+}
+
 /*
  * Common write function for files in palloc cgroup
  */
@@ -69,20 +830,40 @@ static int palloc_file_write(struct cgroup *cgrp, struct cftype *cft,
 {
 	int retval = 0;
 	struct palloc *ph = cgroup_ph(cgrp);
+	unsigned long *map = NULL;
+	COLOR_BITMAP(old);
 
 	if (!cgroup_lock_live_group(cgrp))
 		return -ENODEV;
 
 	switch (cft->private) {
 	case FILE_PALLOC:
-		retval = update_bitmask(ph->cmap, buf, palloc_bins());
+		bitmap_copy(old, ph->bins, MAX_PALLOC_BINS);
+		map = ph->bins;
+		retval = update_bitmask(map, buf, palloc_bins());
 		printk(KERN_INFO "Bins : %s\n", buf);
 		break;
+	case FILE_CACHE_BINS:
+		bitmap_copy(old, ph->cache_bins, MAX_PALLOC_BINS);
+		map = ph->cache_bins;
+		retval = update_bitmask(map, buf, palloc_cache_bins());
+		break;
+	case FILE_BANK_BINS:
+		bitmap_copy(old, ph->bank_bins, MAX_PALLOC_BINS);
+		map = ph->bank_bins;
+		retval = update_bitmask(map, buf, palloc_bank_bins());
+		break;
 	default:
 		retval = -EINVAL;
 		break;
 	}
 
+	if (!retval)
+		retval = palloc_update_cmap(ph);
+	if (retval && map)
+		/* no usable color left, or outside of the parent's bins */
+		bitmap_copy(map, old, MAX_PALLOC_BINS);
+
 	cgroup_unlock();
 	return retval;
 }
@@ -105,9 +886,20 @@ static ssize_t palloc_file_read(struct cgroup *cgrp,
 
 	switch (cft->private) {
 	case FILE_PALLOC:
-		s += bitmap_scnlistprintf(s, PAGE_SIZE, ph->cmap, palloc_bins());
+		s += bitmap_scnlistprintf(s, PAGE_SIZE, ph->bins, palloc_bins());
 		printk(KERN_INFO "Bins : %s\n", s);
 		break;
+	case FILE_CACHE_BINS:
+		s += bitmap_scnlistprintf(s, PAGE_SIZE, ph->cache_bins,
+					  palloc_cache_bins());
+		break;
+	case FILE_BANK_BINS:
+		s += bitmap_scnlistprintf(s, PAGE_SIZE, ph->bank_bins,
+					  palloc_bank_bins());
+		break;
+	case FILE_EFFECTIVE:
+		s += bitmap_scnlistprintf(s, PAGE_SIZE, ph->cmap, palloc_bins());
+		break;
 	default:
 		retval = -EINVAL;
 		goto out;
@@ -120,6 +912,165 @@ out:
 	return retval;
 }
 
+static u64 palloc_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+
+	switch (cft->private) {
+	case FILE_MIGRATE:
+		return ph->migrate;
+	case FILE_MIGRATE_RATE:
+		return ph->migrate_rate;
+	case FILE_RESERVE:
+		return ph->reserve;
+	case FILE_EXCLUSIVE:
+		return ph->exclusive;
+	default:
+		BUG();
+	}
+	return 0;
+}
+
+static int palloc_write_u64(struct cgroup *cgrp, struct cftype *cft, u64 val)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	int ret = 0;
+
+	switch (cft->private) {
+	case FILE_MIGRATE:
+		ph->migrate = !!val;
+		break;
+	case FILE_MIGRATE_RATE:
+		ph->migrate_rate = val;
+		break;
+	case FILE_RESERVE:
+		if (val > totalram_pages)
+			return -EINVAL;
+		ph->reserve = val;
+		palloc_reserve_drain(ph, val);
+		/* populate the pool now, kpallocd keeps it filled */
+		palloc_reserve_fill(ph);
+		break;
+	case FILE_EXCLUSIVE:
+		if (!cgroup_lock_live_group(cgrp))
+			return -ENODEV;
+		ret = palloc_set_exclusive(ph, !!val);
+		cgroup_unlock();
+		break;
+	default:
+		return -EINVAL;
+	}
+	return ret;
+}
+
+static int palloc_migrate_stat(struct cgroup *cgrp, struct cftype *cft,
+			       struct cgroup_map_cb *cb)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	u64 ms = div_u64(ph->migrate_ns, NSEC_PER_MSEC);
+
+	cb->fill(cb, "scanned", ph->nr_scanned);
+	cb->fill(cb, "migrated", ph->nr_migrated);
+	cb->fill(cb, "failed", ph->nr_failed);
+	cb->fill(cb, "pending", !list_empty(&ph->recolor_node));
+	cb->fill(cb, "time_ms", ms);
+	/* pages per second */
+	cb->fill(cb, "throughput",
+		 ms ? div64_u64(ph->nr_migrated * MSEC_PER_SEC, ms) : 0);
+	return 0;
+}
+
+/* sum a per-cpu counter of ph */
+#define palloc_stat_sum(ph, field)				\
+({								\
+	u64 __sum = 0;						\
+	int __cpu;						\
+	for_each_possible_cpu(__cpu)				\
+		__sum += per_cpu_ptr((ph)->stat, __cpu)->field;	\
+	__sum;							\
+})
+
+static int palloc_stat_show(struct cgroup *cgrp, struct cftype *cft,
+			    struct cgroup_map_cb *cb)
+{
+	static const char * const names[NR_PALLOC_STAT_ITEMS] = {
+		"hit", "miss", "fallback", "fail", "iters",
+		"neighbor", "strict_fail", "interleave", "reserve",
+	};
+	struct palloc *ph = cgroup_ph(cgrp);
+	int i;
+
+	for (i = 0; i < NR_PALLOC_STAT_ITEMS; i++)
+		cb->fill(cb, names[i], palloc_stat_sum(ph, count[i]));
+	cb->fill(cb, "reserve_pages", ph->nr_pool);
+	return 0;
+}
+
+static int palloc_latency_show(struct cgroup *cgrp, struct cftype *cft,
+			       struct seq_file *m)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	u64 cnt;
+	int i;
+
+	/* <lower bound in ns> <count> */
+	for (i = 0; i < PALLOC_LAT_BUCKETS; i++) {
+		cnt = palloc_stat_sum(ph, latency[i]);
+		if (cnt)
+			seq_printf(m, "%llu %llu\n", 1ULL << i, cnt);
+	}
+	return 0;
+}
+
+static const char * const palloc_policy_names[NR_PALLOC_POLICIES] = {
+	"preferred", "strict", "interleave",
+};
+
+/* list the policies, the current one in brackets */
+static int palloc_policy_show(struct cgroup *cgrp, struct cftype *cft,
+			      struct seq_file *m)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	int i;
+
+	for (i = 0; i < NR_PALLOC_POLICIES; i++)
+		seq_printf(m, i == ph->policy ? "%s[%s]" : "%s%s",
+			   i ? " " : "", palloc_policy_names[i]);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int palloc_policy_write(struct cgroup *cgrp, struct cftype *cft,
+			       const char *buf)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	int i;
+
+	for (i = 0; i < NR_PALLOC_POLICIES; i++) {
+		if (!strcmp(strstrip((char *)buf), palloc_policy_names[i])) {
+			ph->policy = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int palloc_color_show(struct cgroup *cgrp, struct cftype *cft,
+			     struct seq_file *m)
+{
+	struct palloc *ph = cgroup_ph(cgrp);
+	u64 alloc, freed;
+	int c;
+
+	/* <color> <pages allocated> <pages of those not freed yet> */
+	for (c = 0; c < palloc_bins(); c++) {
+		alloc = palloc_stat_sum(ph, color[c]);
+		freed = palloc_stat_sum(ph, freed[c]);
+		seq_printf(m, "%d %llu %llu\n", c, alloc,
+			   alloc > freed ? alloc - freed : 0);
+	}
+	return 0;
+}
 
 /*
  * struct cftype: handler definitions for cgroup control files
@@ -134,9 +1085,100 @@ static struct cftype files[] = {
 		.max_write_len = MAX_LINE_LEN,
 		.private = FILE_PALLOC,
 	},
+	{
+		.name = "cache_bins",
+		.read = palloc_file_read,
+		.write_string = palloc_file_write,
+		.max_write_len = MAX_LINE_LEN,
+		.private = FILE_CACHE_BINS,
+	},
+	{
+		.name = "bank_bins",
+		.read = palloc_file_read,
+		.write_string = palloc_file_write,
+		.max_write_len = MAX_LINE_LEN,
+		.private = FILE_BANK_BINS,
+	},
+	{
+		.name = "effective_bins",
+		.read = palloc_file_read,
+		.private = FILE_EFFECTIVE,
+	},
+	{
+		.name = "exclusive",
+		.read_u64 = palloc_read_u64,
+		.write_u64 = palloc_write_u64,
+		.private = FILE_EXCLUSIVE,
+	},
+	{
+		.name = "policy",
+		.read_seq_string = palloc_policy_show,
+		.write_string = palloc_policy_write,
+		.max_write_len = 16,
+	},
+	{
+		.name = "stat",
+		.read_map = palloc_stat_show,
+	},
+	{
+		.name = "latency",
+		.read_seq_string = palloc_latency_show,
+	},
+	{
+		.name = "color_stat",
+		.read_seq_string = palloc_color_show,
+	},
+	{
+		.name = "migrate",
+		.read_u64 = palloc_read_u64,
+		.write_u64 = palloc_write_u64,
+		.private = FILE_MIGRATE,
+	},
+	{
+		.name = "migrate_rate",
+		.read_u64 = palloc_read_u64,
+		.write_u64 = palloc_write_u64,
+		.private = FILE_MIGRATE_RATE,
+	},
+	{
+		.name = "reserve",
+		.read_u64 = palloc_read_u64,
+		.write_u64 = palloc_write_u64,
+		.private = FILE_RESERVE,
+	},
+	{
+		.name = "migrate_stat",
+		.read_map = palloc_migrate_stat,
+	},
 	{ }	/* terminate */
 };
 
+/* initialize the locks and lists of a new group */
+static int palloc_init_group(struct palloc *ph)
+{
+	static atomic_t serial;
+	int i, nr = nr_node_ids * MAX_NR_ZONES;
+
+	ph->stat = alloc_percpu(struct palloc_cpu_stat);
+	ph->pool = kmalloc(nr * sizeof(struct list_head), GFP_KERNEL);
+	ph->node_pool = kcalloc(nr_node_ids, sizeof(unsigned long),
+				GFP_KERNEL);
+	if (!ph->stat || !ph->pool || !ph->node_pool) {
+		free_percpu(ph->stat);
+		kfree(ph->pool);
+		kfree(ph->node_pool);
+		return -ENOMEM;
+	}
+	ph->serial = atomic_inc_return(&serial);
+	spin_lock_init(&ph->lock);
+	INIT_LIST_HEAD(&ph->recolor_node);
+	spin_lock_init(&ph->pool_lock);
+	for (i = 0; i < nr; i++)
+		INIT_LIST_HEAD(&ph->pool[i]);
+	INIT_LIST_HEAD(&ph->reserve_node);
+	return 0;
+}
+
 /*
  * palloc_create - create a palloc group
  */
@@ -148,18 +1190,36 @@ static struct cgroup_subsys_state *palloc_create(struct cgroup *cgrp)
 	printk(KERN_INFO "Creating the new cgroup - %p\n", cgrp);
 
 	if (!cgrp->parent) {
+		if (palloc_init_group(&top_palloc))
+			return ERR_PTR(-ENOMEM);
 		return &top_palloc.css;
 	}
 	ph_parent = cgroup_ph(cgrp->parent);
 
-	ph_child = kmalloc(sizeof(struct palloc), GFP_KERNEL);
+	ph_child = kzalloc(sizeof(struct palloc), GFP_KERNEL);
 	if(!ph_child)
 		return ERR_PTR(-ENOMEM);
 
-	bitmap_clear(ph_child->cmap, 0, MAX_PALLOC_BINS);
+	if (palloc_init_group(ph_child)) {
+		kfree(ph_child);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* start out with the parent's bins, less its exclusive children's */
+	palloc_effective_cmap(ph_child, ph_parent, ph_child->cmap, false);
+	ph_child->nr_cmap = bitmap_weight(ph_child->cmap, MAX_PALLOC_BINS);
 	return &ph_child->css;
 }
 
+static void palloc_free_rcu(struct rcu_head *head)
+{
+	struct palloc *ph = container_of(head, struct palloc, rcu);
+
+	free_percpu(ph->stat);
+	kfree(ph->pool);
+	kfree(ph->node_pool);
+	kfree(ph);
+}
 
 /*
  * Destroy an existing palloc group
@@ -168,7 +1228,21 @@ static void palloc_destroy(struct cgroup *cgrp)
 {
 	struct palloc *ph = cgroup_ph(cgrp);
 	printk(KERN_INFO "Deleting the cgroup - %p\n",cgrp);
-	kfree(ph);
+	spin_lock(&recolor_lock);
+	list_del_init(&ph->recolor_node);
+	spin_unlock(&recolor_lock);
+	spin_lock_irq(&reserve_lock);
+	list_del_init(&ph->reserve_node);
+	spin_unlock_irq(&reserve_lock);
+	palloc_reserve_drain(ph, 0);
+	if (ph->exclusive) {
+		/* hand the bins back to the siblings inheriting them */
+		ph->exclusive = 0;
+		palloc_refresh_subtree(cgrp->parent, ph);
+	}
+	free_css_id(&palloc_subsys, &ph->css);
+	/* palloc_owner_group() users may still count into ph->stat */
+	call_rcu(&ph->rcu, palloc_free_rcu);
 }
 
 struct cgroup_subsys palloc_subsys = {
@@ -177,6 +1251,7 @@ struct cgroup_subsys palloc_subsys = {
 	.destroy = palloc_destroy,
 	.subsys_id = palloc_subsys_id,
 	.base_cftypes = files,
+	.use_id = true,
 };
 
 #endif /* CONFIG_CGROUP_PALLOC */
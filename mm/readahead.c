@@ -155,9 +155,11 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			unsigned long lookahead_size)
 {
 	struct inode *inode = mapping->host;
-	struct page *page;
+	struct page *page, *next;
 	unsigned long end_index;	/* The last page we want to read */
 	LIST_HEAD(page_pool);
+	LIST_HEAD(fresh);		/* allocated, not used yet */
+	int bulk = 0;
 	int page_idx;
 	int ret = 0;
 	loff_t isize = i_size_read(inode);
@@ -182,7 +184,21 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		if (page)
 			continue;
 
-		page = page_cache_alloc_readahead(mapping);
+		/*
+		 * Allocate the rest of the window at once, most of it is
+		 * usually not cached either.
+		 */
+		if (!bulk) {
+			bulk = 1;
+			page_cache_alloc_readahead_bulk(mapping,
+				min_t(unsigned long, nr_to_read - page_idx,
+				      end_index - page_offset + 1), &fresh);
+		}
+		if (!list_empty(&fresh)) {
+			page = list_first_entry(&fresh, struct page, lru);
+			list_del(&page->lru);
+		} else
+			page = page_cache_alloc_readahead(mapping);
 		if (!page)
 			break;
 		page->index = page_offset;
@@ -200,6 +216,10 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	if (ret)
 		read_pages(mapping, filp, &page_pool, ret);
 	BUG_ON(!list_empty(&page_pool));
+	list_for_each_entry_safe(page, next, &fresh, lru) {
+		list_del(&page->lru);
+		page_cache_release(page);
+	}
 out:
 	return ret;
 }
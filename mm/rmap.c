@@ -26,7 +26,7 @@
  *       mapping->i_mmap_mutex
  *         anon_vma->mutex
  *           mm->page_table_lock or pte_lock
- *             zone->lru_lock (in mark_page_accessed, isolate_lru_page)
+ *             lruvec->lru_lock (in mark_page_accessed, isolate_lru_page)
  *             swap_lock (in swap_duplicate, swap_info_get)
  *               mmlist_lock (in mmput, drain_mmlist and others)
  *               mapping->private_lock (in __set_page_dirty_buffers)
@@ -37,6 +37,15 @@
  *                           in arch-dependent flush_dcache_mmap_lock,
  *                           within bdi.wb->list_lock in __sync_single_inode)
  *
+ * lock_page_cgroup (in __mem_cgroup_commit_charge, mem_cgroup_move_account)
+ *   lruvec->lru_lock (of a page that is not a THP)
+ *
+ * compound_lock (in mem_cgroup_move_parent)
+ *   lock_page_cgroup (a THP moves without its lru_lock, see move_account)
+ *
+ * lruvec->lru_lock (in __split_huge_page_refcount)
+ *   compound_lock
+ *
  * anon_vma->mutex,mapping->i_mutex      (memory_failure, collect_procs_anon)
  *   ->tasklist_lock
  *     pte map lock
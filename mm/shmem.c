@@ -58,6 +58,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/security.h>
 #include <linux/swapops.h>
 #include <linux/mempolicy.h>
+#include <linux/palloc.h>
 #include <linux/namei.h>
 #include <linux/ctype.h>
 #include <linux/migrate.h>
@@ -1076,6 +1077,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 	struct address_space *mapping = inode->i_mapping;
 	struct shmem_inode_info *info;
 	struct shmem_sb_info *sbinfo;
+	struct palloc *ph, *old_ph;
 	struct page *page;
 	swp_entry_t swap;
 	int error;
@@ -1125,7 +1127,12 @@ repeat:
 			/* here we actually do the io */
 			if (fault_type)
 				*fault_type |= VM_FAULT_MAJOR;
+			/* in the bins of the file's group, as its page cache */
+			ph = palloc_get_mapping_group(mapping);
+			old_ph = palloc_set_current(ph);
 			page = shmem_swapin(swap, gfp, info, index);
+			palloc_set_current(old_ph);
+			palloc_put_group(ph);
 			if (!page) {
 				error = -ENOMEM;
 				goto failed;
@@ -17,7 +17,9 @@
 #include <linux/blkdev.h>
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
+#include <linux/mempolicy.h>
 #include <linux/page_cgroup.h>
+#include <linux/palloc.h>
 
 #include <asm/pgtable.h>
 
@@ -278,8 +280,9 @@ struct page * lookup_swap_cache(swp_entry_t entry)
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, struct list_head *pool)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -297,6 +300,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		/*
 		 * Get a new page to read into from swap.
 		 */
+		if (!new_page && pool && !list_empty(pool)) {
+			new_page = list_first_entry(pool, struct page, lru);
+			list_del(&new_page->lru);
+		}
 		if (!new_page) {
 			new_page = alloc_page_vma(gfp_mask, vma, addr);
 			if (!new_page)
@@ -346,11 +353,19 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		swapcache_free(entry, NULL);
 	} while (err != -ENOMEM);
 
-	if (new_page)
+	if (new_page && pool)
+		list_add(&new_page->lru, pool);
+	else if (new_page)
 		page_cache_release(new_page);
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, NULL);
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -378,6 +393,8 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	unsigned long start_offset, end_offset;
 	unsigned long mask = (1UL << page_cluster) - 1;
 	struct blk_plug plug;
+	struct page *next;
+	LIST_HEAD(pool);
 
 	/* Read a page_cluster sized and aligned cluster around offset. */
 	start_offset = offset & ~mask;
@@ -385,17 +402,32 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	if (!start_offset)	/* First page is swap header. */
 		start_offset++;
 
+	/*
+	 * Allocate the pages of the cluster at once in the bins of the
+	 * current task's palloc group, unless a memory policy is to pick
+	 * their nodes. The pages already in the swap cache are left over.
+	 */
+	if (!vma || !vma_policy(vma))
+		palloc_alloc_pages_bulk(NULL, gfp_mask,
+					end_offset - start_offset + 1, &pool);
+
 	blk_start_plug(&plug);
 	for (offset = start_offset; offset <= end_offset ; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
+		page = __read_swap_cache_async(swp_entry(swp_type(entry),
+							 offset),
+					       gfp_mask, vma, addr, &pool);
 		if (!page)
 			continue;
 		page_cache_release(page);
 	}
 	blk_finish_plug(&plug);
 
+	list_for_each_entry_safe(page, next, &pool, lru) {
+		list_del(&page->lru);
+		page_cache_release(page);
+	}
+
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -36,6 +36,7 @@
 #include <linux/rwsem.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
+#include <linux/memory_hotplug.h>
 #include <linux/freezer.h>
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
@@ -1035,7 +1036,7 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 }
 
 /*
- * zone->lru_lock is heavily contended.  Some of the functions that
+ * The lru locks are heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
@@ -1128,11 +1129,9 @@ int isolate_lru_page(struct page *page)
 	VM_BUG_ON(!page_count(page));
 
 	if (PageLRU(page)) {
-		struct zone *zone = page_zone(page);
 		struct lruvec *lruvec;
 
-		spin_lock_irq(&zone->lru_lock);
-		lruvec = mem_cgroup_page_lruvec(page, zone);
+		lruvec = lock_page_lruvec_irq(page);
 		if (PageLRU(page)) {
 			int lru = page_lru(page);
 			get_page(page);
@@ -1140,7 +1139,7 @@ int isolate_lru_page(struct page *page)
 			del_page_from_lru_list(page, lruvec, lru);
 			ret = 0;
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		unlock_lruvec_irq(lruvec);
 	}
 	return ret;
 }
@@ -1170,11 +1169,15 @@ static int too_many_isolated(struct zone *zone, int file,
 	return isolated > inactive;
 }
 
+/*
+ * Called with the lru lock of @lruvec held, which is also held on return.
+ * The pages may have been moved to another memcg while isolated, so each
+ * one goes back under the lock of the lruvec it belongs to now.
+ */
 static noinline_for_stack void
 putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 {
-	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
-	struct zone *zone = lruvec_zone(lruvec);
+	struct lruvec *locked = lruvec;
 	LIST_HEAD(pages_to_free);
 
 	/*
@@ -1187,37 +1190,44 @@ putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 		VM_BUG_ON(PageLRU(page));
 		list_del(&page->lru);
 		if (unlikely(!page_evictable(page, NULL))) {
-			spin_unlock_irq(&zone->lru_lock);
+			spin_unlock_irq(locked->lru_lock);
 			putback_lru_page(page);
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(lruvec->lru_lock);
+			locked = lruvec;
 			continue;
 		}
 
-		lruvec = mem_cgroup_page_lruvec(page, zone);
+		locked = __relock_page_lruvec(page, locked);
 
 		SetPageLRU(page);
 		lru = page_lru(page);
-		add_page_to_lru_list(page, lruvec, lru);
+		add_page_to_lru_list(page, locked, lru);
 
 		if (is_active_lru(lru)) {
 			int file = is_file_lru(lru);
 			int numpages = hpage_nr_pages(page);
-			reclaim_stat->recent_rotated[file] += numpages;
+			locked->reclaim_stat.recent_rotated[file] += numpages;
 		}
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
 			__ClearPageActive(page);
-			del_page_from_lru_list(page, lruvec, lru);
+			del_page_from_lru_list(page, locked, lru);
 
 			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(locked->lru_lock);
 				(*get_compound_page_dtor(page))(page);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(lruvec->lru_lock);
+				locked = lruvec;
 			} else
 				list_add(&page->lru, &pages_to_free);
 		}
 	}
 
+	if (locked->lru_lock != lruvec->lru_lock) {
+		spin_unlock(locked->lru_lock);
+		spin_lock(lruvec->lru_lock);
+	}
+
 	/*
 	 * To save our caller's stack, now use input list for pages to free.
 	 */
@@ -1258,7 +1268,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	if (!sc->may_writepage)
 		isolate_mode |= ISOLATE_CLEAN;
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lruvec->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list,
 				     &nr_scanned, sc, isolate_mode, lru);
@@ -1273,7 +1283,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 		else
 			__count_zone_vm_events(PGSCAN_DIRECT, zone, nr_scanned);
 	}
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lruvec->lru_lock);
 
 	if (nr_taken == 0)
 		return 0;
@@ -1281,7 +1291,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	nr_reclaimed = shrink_page_list(&page_list, zone, sc,
 						&nr_dirty, &nr_writeback);
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lruvec->lru_lock);
 
 	reclaim_stat->recent_scanned[file] += nr_taken;
 
@@ -1298,7 +1308,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
 
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lruvec->lru_lock);
 
 	free_hot_cold_page_list(&page_list, 1);
 
@@ -1344,9 +1354,9 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone->lru_lock across the whole operation.  But if
+ * appropriate to hold the lru lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone->lru_lock around each page.  It's impossible to balance
+ * should drop the lru lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -1361,35 +1371,41 @@ static void move_active_pages_to_lru(struct lruvec *lruvec,
 				     enum lru_list lru)
 {
 	struct zone *zone = lruvec_zone(lruvec);
+	struct lruvec *locked = lruvec;
 	unsigned long pgmoved = 0;
 	struct page *page;
 	int nr_pages;
 
 	while (!list_empty(list)) {
 		page = lru_to_page(list);
-		lruvec = mem_cgroup_page_lruvec(page, zone);
+		locked = __relock_page_lruvec(page, locked);
 
 		VM_BUG_ON(PageLRU(page));
 		SetPageLRU(page);
 
 		nr_pages = hpage_nr_pages(page);
-		mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-		list_move(&page->lru, &lruvec->lists[lru]);
+		mem_cgroup_update_lru_size(locked, lru, nr_pages);
+		list_move(&page->lru, &locked->lists[lru]);
 		pgmoved += nr_pages;
 
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
 			__ClearPageActive(page);
-			del_page_from_lru_list(page, lruvec, lru);
+			del_page_from_lru_list(page, locked, lru);
 
 			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(locked->lru_lock);
 				(*get_compound_page_dtor(page))(page);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(lruvec->lru_lock);
+				locked = lruvec;
 			} else
 				list_add(&page->lru, pages_to_free);
 		}
 	}
+	if (locked->lru_lock != lruvec->lru_lock) {
+		spin_unlock(locked->lru_lock);
+		spin_lock(lruvec->lru_lock);
+	}
 	__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 	if (!is_active_lru(lru))
 		__count_vm_events(PGDEACTIVATE, pgmoved);
@@ -1420,7 +1436,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	if (!sc->may_writepage)
 		isolate_mode |= ISOLATE_CLEAN;
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lruvec->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &l_hold,
 				     &nr_scanned, sc, isolate_mode, lru);
@@ -1432,7 +1448,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	__count_zone_vm_events(PGREFILL, zone, nr_scanned);
 	__mod_zone_page_state(zone, NR_LRU_BASE + lru, -nr_taken);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lruvec->lru_lock);
 
 	while (!list_empty(&l_hold)) {
 		cond_resched();
@@ -1477,7 +1493,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	/*
 	 * Move pages back to the lru list.
 	 */
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lruvec->lru_lock);
 	/*
 	 * Count referenced pages from currently used mappings as rotated,
 	 * even though only some of them are actually re-activated.  This
@@ -1489,7 +1505,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	move_active_pages_to_lru(lruvec, &l_active, &l_hold, lru);
 	move_active_pages_to_lru(lruvec, &l_inactive, &l_hold, lru - LRU_ACTIVE);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lruvec->lru_lock);
 
 	free_hot_cold_page_list(&l_hold, 1);
 }
@@ -1676,7 +1692,7 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	 *
 	 * anon in [0], file in [1]
 	 */
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(lruvec->lru_lock);
 	if (unlikely(reclaim_stat->recent_scanned[0] > anon / 4)) {
 		reclaim_stat->recent_scanned[0] /= 2;
 		reclaim_stat->recent_rotated[0] /= 2;
@@ -1697,7 +1713,7 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 
 	fp = file_prio * (reclaim_stat->recent_scanned[1] + 1);
 	fp /= reclaim_stat->recent_rotated[1] + 1;
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(lruvec->lru_lock);
 
 	fraction[0] = ap;
 	fraction[1] = fp;
@@ -1793,6 +1809,547 @@ static inline bool should_continue_reclaim(struct lruvec *lruvec,
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-generation LRU
+ *
+ * With vm.lru_gen_enabled set, evictable pages are kept on per-lruvec
+ * generation lists instead of the active and inactive lists.  max_seq
+ * numbers the youngest generation and min_seq[] the oldest one of each
+ * type.  Pages join the youngest generation if they would have gone to an
+ * active list, and the oldest one otherwise.
+ *
+ * Aging creates a new youngest generation and walks the page tables of
+ * the processes that may have pages on the lruvec, moving every page with
+ * the accessed bit set into it.  Scanning page tables is much cheaper than
+ * the rmap walks shrink_active_list() does for each mapped page, and it
+ * finds hot pages in clusters.  Eviction takes pages from the oldest
+ * generation and hands them to shrink_page_list() as usual.
+ *
+ * The zone and memcg counters keep following page_lru(), so the statistics
+ * and the heuristics built on them do not change.  Pages move between the
+ * two kinds of lists when reclaim first visits a lruvec after the sysctl
+ * has been changed.
+ */
+int sysctl_lru_gen_enabled __read_mostly;
+
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_mm_node, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+/*
+ * Walkers hold mm_count rather than mm_users, and check mm_users under
+ * mmap_sem.  Wait for the ones that got in before the page tables go.
+ */
+void lru_gen_exit_mm(struct mm_struct *mm)
+{
+	down_write(&mm->mmap_sem);
+	up_write(&mm->mmap_sem);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del(&mm->lru_gen_mm_node);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+static unsigned long lru_gen_size(struct lruvec *lruvec, int file)
+{
+	return get_lru_size(lruvec, LRU_BASE + file * LRU_FILE) +
+	       get_lru_size(lruvec, LRU_ACTIVE + file * LRU_FILE);
+}
+
+/*
+ * Move pages between the active/inactive lists and the generation lists,
+ * oldest first so that their order is kept.  Disabling is also used to
+ * empty the generation lists of a memcg that goes away.
+ */
+void lru_gen_convert_lruvec(struct lruvec *lruvec, bool enable)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long batch = 0;
+	struct list_head *head;
+	struct page *page;
+	enum lru_list lru;
+	unsigned long seq;
+	int file;
+
+	spin_lock_irq(lruvec->lru_lock);
+	if (enable) {
+		for_each_evictable_lru(lru) {
+			head = &lruvec->lists[lru];
+			while (!list_empty(head)) {
+				page = lru_to_page(head);
+				list_del(&page->lru);
+				if (!lru_gen_add_page(page, lruvec, lru)) {
+					/* disabled again under us */
+					list_add_tail(&page->lru, head);
+					goto out;
+				}
+				if (++batch % SWAP_CLUSTER_MAX == 0) {
+					spin_unlock_irq(lruvec->lru_lock);
+					cond_resched();
+					spin_lock_irq(lruvec->lru_lock);
+				}
+			}
+		}
+		goto out;
+	}
+
+	for (file = 0; file < 2; file++) {
+		for (seq = lrugen->min_seq[file]; seq <= lrugen->max_seq; seq++) {
+			head = &lrugen->lists[lru_gen_from_seq(seq)][file];
+			while (!list_empty(head)) {
+				page = lru_to_page(head);
+				lru_gen_del_page(page);
+				list_add(&page->lru, &lruvec->lists[page_lru(page)]);
+				if (++batch % SWAP_CLUSTER_MAX == 0) {
+					spin_unlock_irq(lruvec->lru_lock);
+					cond_resched();
+					spin_lock_irq(lruvec->lru_lock);
+				}
+			}
+		}
+	}
+out:
+	spin_unlock_irq(lruvec->lru_lock);
+}
+
+static bool lru_gen_needs_convert(struct lruvec *lruvec, bool enable)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	enum lru_list lru;
+	int gen, file;
+
+	if (enable) {
+		for_each_evictable_lru(lru)
+			if (!list_empty(&lruvec->lists[lru]))
+				return true;
+		return false;
+	}
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++)
+		for (file = 0; file < 2; file++)
+			if (!list_empty(&lrugen->lists[gen][file]))
+				return true;
+	return false;
+}
+
+struct lru_gen_walk {
+	struct lruvec *lruvec;
+	struct vm_area_struct *vma;
+	unsigned long nr_young;
+};
+
+/*
+ * Move a page found young in a page table to the youngest generation of
+ * its lruvec.  Returns the lruvec whose lock is held, which may be a
+ * different one than @locked.
+ */
+static struct lruvec *lru_gen_promote(struct page *page, struct lruvec *locked)
+{
+	bool active;
+
+	if (!PageLRU(page) || page_lru_gen(page) < 0)
+		return locked;
+
+	locked = relock_page_lruvec_irq(page, locked);
+	if (!PageLRU(page) || page_lru_gen(page) < 0)
+		return locked;
+
+	active = PageActive(page);
+	del_page_from_lru_list(page, locked, page_lru(page));
+	SetPageActive(page);
+	add_page_to_lru_list(page, locked, page_lru(page));
+	if (!active)
+		__count_vm_events(PGACTIVATE, hpage_nr_pages(page));
+	return locked;
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma = args->vma;
+	struct lruvec *locked = NULL;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (pmd_trans_huge_lock(pmd, vma) == 1) {
+		page = pmd_page(*pmd);
+		/* leave the accessed bit of other lruvecs to their own walk */
+		if (PageLRU(page) && page_in_lruvec(page, args->lruvec) &&
+		    pmdp_test_and_clear_young(vma, addr, pmd)) {
+			locked = lru_gen_promote(page, locked);
+			args->nr_young += HPAGE_PMD_NR;
+		}
+		if (locked)
+			unlock_lruvec_irq(locked);
+		spin_unlock(&walk->mm->page_table_lock);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(page) ||
+		    !page_in_lruvec(page, args->lruvec))
+			continue;
+		if (!ptep_test_and_clear_young(vma, addr, pte))
+			continue;
+		locked = lru_gen_promote(page, locked);
+		args->nr_young++;
+	}
+	if (locked)
+		unlock_lruvec_irq(locked);
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma;
+
+	/* reclaim may run with the mmap_sem of current->mm held */
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	if (atomic_read(&mm->mm_users)) {
+		walk->mm = mm;
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (vma->vm_flags & (VM_LOCKED | VM_IO | VM_PFNMAP |
+					     VM_HUGETLB))
+				continue;
+			args->vma = vma;
+			walk_page_range(vma->vm_start, vma->vm_end, walk);
+		}
+	}
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Walk the page tables of the processes in the memcg of @lruvec, or of
+ * all processes without memcg, and promote the pages of @lruvec accessed
+ * since the last walk.
+ */
+static void lru_gen_walk_mms(struct lruvec *lruvec)
+{
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	struct lru_gen_walk args = { .lruvec = lruvec };
+	struct mm_walk walk = {
+		.pmd_entry	= lru_gen_walk_pmd,
+		.private	= &args,
+	};
+	struct mm_struct *mm, *prev = NULL;
+	bool found;
+
+	for (;;) {
+		found = false;
+		spin_lock(&lru_gen_mm_lock);
+		mm = list_prepare_entry(prev, &lru_gen_mm_list,
+					lru_gen_mm_node);
+		list_for_each_entry_continue(mm, &lru_gen_mm_list,
+					     lru_gen_mm_node) {
+			if (atomic_read(&mm->mm_users) &&
+			    atomic_inc_not_zero(&mm->mm_count)) {
+				found = true;
+				break;
+			}
+		}
+		spin_unlock(&lru_gen_mm_lock);
+
+		/* prev pinned our position on the list up to here */
+		if (prev)
+			mmdrop(prev);
+		if (!found)
+			break;
+		prev = mm;
+
+		if (memcg && !mm_match_cgroup(mm, memcg))
+			continue;
+		lru_gen_walk_mm(mm, &walk);
+	}
+	count_vm_events(PGLRUGEN_YOUNG, args.nr_young);
+}
+
+/*
+ * Create a new youngest generation, unless somebody else already did
+ * since max_seq was @seq.  The oldest generation of a type is folded into
+ * the next one first if all MAX_NR_GENS are in use.
+ */
+static void lru_gen_age(struct lruvec *lruvec, unsigned long seq)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long batch = 0;
+	struct list_head *head;
+	struct page *page;
+	int file;
+
+	spin_lock_irq(lruvec->lru_lock);
+	for (file = 0; file < 2; file++) {
+		while (seq == lrugen->max_seq &&
+		       lrugen->max_seq - lrugen->min_seq[file] + 1 >=
+		       MAX_NR_GENS) {
+			head = &lrugen->lists[lru_gen_from_seq(
+					lrugen->min_seq[file])][file];
+			if (list_empty(head)) {
+				lrugen->min_seq[file]++;
+				continue;
+			}
+			/* youngest first, to the older end of the next one */
+			page = list_entry(head->next, struct page, lru);
+			lru_gen_move_page(page, lruvec,
+					  lrugen->min_seq[file] + 1, true);
+			if (++batch % SWAP_CLUSTER_MAX == 0) {
+				spin_unlock_irq(lruvec->lru_lock);
+				cond_resched();
+				spin_lock_irq(lruvec->lru_lock);
+			}
+		}
+	}
+
+	if (seq != lrugen->max_seq) {
+		spin_unlock_irq(lruvec->lru_lock);
+		return;
+	}
+	lrugen->max_seq++;
+	spin_unlock_irq(lruvec->lru_lock);
+
+	count_vm_event(PGLRUGEN_AGE);
+	lru_gen_walk_mms(lruvec);
+}
+
+/* Retire an empty oldest generation, keeping at least MIN_NR_GENS */
+static bool lru_gen_inc_min_seq(struct lruvec *lruvec, int file)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+
+	if (lrugen->max_seq - lrugen->min_seq[file] + 1 <= MIN_NR_GENS)
+		return false;
+
+	lrugen->min_seq[file]++;
+	return true;
+}
+
+/*
+ * Evict the type whose oldest generation is older, file pages on a tie.
+ * Like get_scan_count(), leave anon pages alone without swap.  Returns -1
+ * if there is nothing to evict.
+ */
+static int lru_gen_pick_type(struct lruvec *lruvec, struct scan_control *sc)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+
+	if (!sc->may_swap || nr_swap_pages <= 0 || !vmscan_swappiness(sc))
+		return lru_gen_size(lruvec, 1) ? 1 : -1;
+	if (!lru_gen_size(lruvec, 1))
+		return 0;
+	if (!lru_gen_size(lruvec, 0))
+		return 1;
+	return lrugen->min_seq[0] >= lrugen->min_seq[1];
+}
+
+/*
+ * Isolate and reclaim up to SWAP_CLUSTER_MAX pages of type file from the
+ * oldest generations.  Running out of generations ages the lruvec, which
+ * walks the page tables of its memcg, only if *aged is not yet set.
+ */
+static noinline_for_stack unsigned long
+lru_gen_evict(struct lruvec *lruvec, int file, struct scan_control *sc,
+	      bool *aged)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	struct zone *zone = lruvec_zone(lruvec);
+	unsigned long nr_scanned = 0;
+	unsigned long nr_taken = 0;
+	unsigned long nr_reclaimed;
+	unsigned long nr_dirty = 0;
+	unsigned long nr_writeback = 0;
+	isolate_mode_t isolate_mode = 0;
+	struct list_head *head;
+	LIST_HEAD(page_list);
+	struct page *page;
+	unsigned long seq;
+	int nr_pages;
+
+	while (unlikely(too_many_isolated(zone, file, sc))) {
+		congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			return SWAP_CLUSTER_MAX;
+	}
+
+	lru_add_drain();
+
+	if (!sc->may_unmap)
+		isolate_mode |= ISOLATE_UNMAPPED;
+	if (!sc->may_writepage)
+		isolate_mode |= ISOLATE_CLEAN;
+
+	spin_lock_irq(lruvec->lru_lock);
+	while (nr_scanned < SWAP_CLUSTER_MAX) {
+		head = &lrugen->lists[lru_gen_from_seq(
+				lrugen->min_seq[file])][file];
+		if (list_empty(head)) {
+			if (lru_gen_inc_min_seq(lruvec, file))
+				continue;
+			if (*aged)
+				break;
+			*aged = true;
+			seq = lrugen->max_seq;
+			spin_unlock_irq(lruvec->lru_lock);
+			lru_gen_age(lruvec, seq);
+			spin_lock_irq(lruvec->lru_lock);
+			continue;
+		}
+
+		page = lru_to_page(head);
+		nr_scanned++;
+
+		/* unmapped page cache accessed once more since it was added */
+		if (file && !page_mapped(page) &&
+		    TestClearPageReferenced(page)) {
+			lru_gen_move_page(page, lruvec,
+					  lrugen->min_seq[file] + 1, false);
+			continue;
+		}
+
+		if (__isolate_lru_page(page, isolate_mode)) {
+			lru_gen_move_page(page, lruvec,
+					  lrugen->min_seq[file] + 1, false);
+			continue;
+		}
+
+		nr_pages = hpage_nr_pages(page);
+		del_page_from_lru_list(page, lruvec, page_lru(page));
+		ClearPageActive(page);
+		list_add(&page->lru, &page_list);
+		nr_taken += nr_pages;
+	}
+
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
+
+	if (global_reclaim(sc)) {
+		zone->pages_scanned += nr_scanned;
+		if (current_is_kswapd())
+			__count_zone_vm_events(PGSCAN_KSWAPD, zone, nr_scanned);
+		else
+			__count_zone_vm_events(PGSCAN_DIRECT, zone, nr_scanned);
+	}
+	spin_unlock_irq(lruvec->lru_lock);
+
+	if (nr_taken == 0)
+		return 0;
+
+	nr_reclaimed = shrink_page_list(&page_list, zone, sc,
+					&nr_dirty, &nr_writeback);
+
+	spin_lock_irq(lruvec->lru_lock);
+
+	lruvec->reclaim_stat.recent_scanned[file] += nr_taken;
+
+	if (global_reclaim(sc)) {
+		if (current_is_kswapd())
+			__count_zone_vm_events(PGSTEAL_KSWAPD, zone,
+					       nr_reclaimed);
+		else
+			__count_zone_vm_events(PGSTEAL_DIRECT, zone,
+					       nr_reclaimed);
+	}
+
+	putback_inactive_pages(lruvec, &page_list);
+
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
+
+	spin_unlock_irq(lruvec->lru_lock);
+
+	free_hot_cold_page_list(&page_list, 1);
+
+	/* see shrink_inactive_list() */
+	if (nr_writeback && nr_writeback >=
+			(nr_taken >> (DEF_PRIORITY - sc->priority)))
+		wait_iff_congested(zone, BLK_RW_ASYNC, HZ/10);
+
+	trace_mm_vmscan_lru_shrink_inactive(zone->zone_pgdat->node_id,
+		zone_idx(zone),
+		nr_scanned, nr_reclaimed,
+		sc->priority,
+		trace_shrink_flags(file));
+	return nr_reclaimed;
+}
+
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc)
+{
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_reclaimed, nr_scanned;
+	unsigned long nr_to_scan, scanned;
+	struct blk_plug plug;
+	bool aged = false;
+	int file;
+
+	if (lru_gen_needs_convert(lruvec, true))
+		lru_gen_convert_lruvec(lruvec, true);
+
+restart:
+	nr_reclaimed = 0;
+	nr_scanned = sc->nr_scanned;
+	nr_to_scan = (lru_gen_size(lruvec, 0) + lru_gen_size(lruvec, 1)) >>
+		     sc->priority;
+	/* see the comment on force_scan in get_scan_count() */
+	if (!nr_to_scan && (!global_reclaim(sc) ||
+	    (current_is_kswapd() && lruvec_zone(lruvec)->all_unreclaimable)))
+		nr_to_scan = SWAP_CLUSTER_MAX;
+
+	blk_start_plug(&plug);
+	/* lru_gen_evict() looks at up to SWAP_CLUSTER_MAX pages per call */
+	for (scanned = 0; scanned < nr_to_scan; scanned += SWAP_CLUSTER_MAX) {
+		file = lru_gen_pick_type(lruvec, sc);
+		if (file < 0)
+			break;
+		nr_reclaimed += lru_gen_evict(lruvec, file, sc, &aged);
+		if (nr_reclaimed >= nr_to_reclaim &&
+		    sc->priority < DEF_PRIORITY)
+			break;
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+
+	/* reclaim/compaction might need reclaim to continue */
+	if (should_continue_reclaim(lruvec, nr_reclaimed,
+				    sc->nr_scanned - nr_scanned, sc))
+		goto restart;
+
+	throttle_vm_writeout(sc->gfp_mask);
+}
+#else
+static inline bool lru_gen_needs_convert(struct lruvec *lruvec, bool enable)
+{
+	return false;
+}
+
+static inline void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+					 struct scan_control *sc)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -1805,6 +2362,13 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
 	struct blk_plug plug;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, sc);
+		return;
+	}
+	if (lru_gen_needs_convert(lruvec, false))
+		lru_gen_convert_lruvec(lruvec, false);
+
 restart:
 	nr_reclaimed = 0;
 	nr_scanned = sc->nr_scanned;
@@ -2164,8 +2728,10 @@ static bool pfmemalloc_watermark_ok(pg_data_t *pgdat)
 
 	/* kswapd must be awake if processes are being throttled */
 	if (!wmark_ok && waitqueue_active(&pgdat->kswapd_wait)) {
-		pgdat->classzone_idx = min(pgdat->classzone_idx,
-						(enum zone_type)ZONE_NORMAL);
+		for (i = 0; i < MAX_KSWAPD_THREADS; i++)
+			pgdat->kswapd_req[i].classzone_idx = min(
+				pgdat->kswapd_req[i].classzone_idx,
+				(enum zone_type)ZONE_NORMAL);
 		wake_up_interruptible(&pgdat->kswapd_wait);
 	}
 
@@ -2351,7 +2917,8 @@ static void age_active_anon(struct zone *zone, struct scan_control *sc)
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	/* the multi-gen LRU has no active list to age */
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
@@ -2792,7 +3359,7 @@ out:
 		}
 
 		if (zones_need_compaction)
-			compact_pgdat(pgdat, order);
+			wakeup_kcompactd(pgdat, order, end_zone);
 	}
 
 	/*
@@ -2871,7 +3438,8 @@ static int kswapd(void *p)
 	unsigned balanced_order;
 	int classzone_idx, new_classzone_idx;
 	int balanced_classzone_idx;
-	pg_data_t *pgdat = (pg_data_t*)p;
+	struct kswapd_request *req = p;
+	pg_data_t *pgdat = req->pgdat;
 	struct task_struct *tsk = current;
 
 	struct reclaim_state reclaim_state = {
@@ -2914,10 +3482,10 @@ static int kswapd(void *p)
 		 */
 		if (balanced_classzone_idx >= new_classzone_idx &&
 					balanced_order == new_order) {
-			new_order = pgdat->kswapd_max_order;
-			new_classzone_idx = pgdat->classzone_idx;
-			pgdat->kswapd_max_order =  0;
-			pgdat->classzone_idx = pgdat->nr_zones - 1;
+			new_order = req->order;
+			new_classzone_idx = req->classzone_idx;
+			req->order = 0;
+			req->classzone_idx = pgdat->nr_zones - 1;
 		}
 
 		if (order < new_order || classzone_idx > new_classzone_idx) {
@@ -2930,12 +3498,12 @@ static int kswapd(void *p)
 		} else {
 			kswapd_try_to_sleep(pgdat, balanced_order,
 						balanced_classzone_idx);
-			order = pgdat->kswapd_max_order;
-			classzone_idx = pgdat->classzone_idx;
+			order = req->order;
+			classzone_idx = req->classzone_idx;
 			new_order = order;
 			new_classzone_idx = classzone_idx;
-			pgdat->kswapd_max_order = 0;
-			pgdat->classzone_idx = pgdat->nr_zones - 1;
+			req->order = 0;
+			req->classzone_idx = pgdat->nr_zones - 1;
 		}
 
 		ret = try_to_freeze();
@@ -2961,7 +3529,9 @@ static int kswapd(void *p)
  */
 void wakeup_kswapd(struct zone *zone, int order, enum zone_type classzone_idx)
 {
+	struct kswapd_request *req;
 	pg_data_t *pgdat;
+	int i;
 
 	if (!populated_zone(zone))
 		return;
@@ -2969,9 +3539,13 @@ void wakeup_kswapd(struct zone *zone, int order, enum zone_type classzone_idx)
 	if (!cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
 		return;
 	pgdat = zone->zone_pgdat;
-	if (pgdat->kswapd_max_order < order) {
-		pgdat->kswapd_max_order = order;
-		pgdat->classzone_idx = min(pgdat->classzone_idx, classzone_idx);
+	for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+		req = &pgdat->kswapd_req[i];
+		if (req->order < order) {
+			req->order = order;
+			req->classzone_idx = min(req->classzone_idx,
+						 classzone_idx);
+		}
 	}
 	if (!waitqueue_active(&pgdat->kswapd_wait))
 		return;
@@ -3068,7 +3642,7 @@ unsigned long shrink_all_memory(unsigned long nr_to_reclaim)
 static int __devinit cpu_callback(struct notifier_block *nfb,
 				  unsigned long action, void *hcpu)
 {
-	int nid;
+	int nid, i;
 
 	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
 		for_each_node_state(nid, N_HIGH_MEMORY) {
@@ -3077,33 +3651,68 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
-				/* One of our CPUs online: restore mask */
-				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+			if (cpumask_any_and(cpu_online_mask, mask) >= nr_cpu_ids)
+				continue;
+			/* One of our CPUs online: restore mask */
+			for (i = 0; i < MAX_KSWAPD_THREADS; i++)
+				if (pgdat->kswapd[i])
+					set_cpus_allowed_ptr(pgdat->kswapd[i],
+							     mask);
 		}
 	}
 	return NOTIFY_OK;
 }
 
 /*
- * This kswapd start function will be called by init and node-hot-add.
+ * Number of kswapd threads per node.  Each gets its own copy of the wakeups
+ * of the node, in pgdat->kswapd_req[], and all run balance_pgdat(), where
+ * the memcg reclaim iterator of each zone and priority hands every lruvec
+ * to one of them, so that the reclaim work is split between them rather
+ * than repeated.
+ */
+int kswapd_threads = 1;
+
+/*
+ * This kswapd start function will be called by init, node-hot-add and
+ * changes of vm.kswapd_threads.  It starts the missing ones of the first
+ * kswapd_threads kswapds of the node and stops the others, and returns
+ * the error of the first one that failed to start.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
  */
 int kswapd_run(int nid)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
-	int ret = 0;
-
-	if (pgdat->kswapd)
-		return 0;
+	struct kswapd_request *req;
+	struct task_struct *tsk;
+	int i, ret = 0;
+
+	for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+		if (i >= kswapd_threads) {
+			if (pgdat->kswapd[i]) {
+				kthread_stop(pgdat->kswapd[i]);
+				pgdat->kswapd[i] = NULL;
+			}
+			continue;
+		}
+		if (pgdat->kswapd[i])
+			continue;
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
-		/* failure at boot is fatal */
-		BUG_ON(system_state == SYSTEM_BOOTING);
-		printk("Failed to start kswapd on node %d\n",nid);
-		pgdat->kswapd = NULL;
-		ret = -1;
+		req = &pgdat->kswapd_req[i];
+		req->pgdat = pgdat;
+		req->order = 0;
+		req->classzone_idx = pgdat->nr_zones - 1;
+		if (i)
+			tsk = kthread_run(kswapd, req, "kswapd%d:%d", nid, i);
+		else
+			tsk = kthread_run(kswapd, req, "kswapd%d", nid);
+		if (IS_ERR(tsk)) {
+			/* failure at boot is fatal */
+			BUG_ON(system_state == SYSTEM_BOOTING);
+			printk("Failed to start kswapd on node %d\n",nid);
+			ret = PTR_ERR(tsk);
+			break;
+		}
+		pgdat->kswapd[i] = tsk;
 	}
 	return ret;
 }
@@ -3114,12 +3723,45 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int i;
+
+	for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+		if (pgdat->kswapd[i]) {
+			kthread_stop(pgdat->kswapd[i]);
+			pgdat->kswapd[i] = NULL;
+		}
+	}
+}
+
+int kswapd_threads_sysctl_handler(struct ctl_table *table, int write,
+				  void __user *buffer, size_t *length,
+				  loff_t *ppos)
+{
+	struct ctl_table t = *table;
+	int nid, ret, old, threads = kswapd_threads;
 
-	if (kswapd) {
-		kthread_stop(kswapd);
-		NODE_DATA(nid)->kswapd = NULL;
+	t.data = &threads;
+	ret = proc_dointvec_minmax(&t, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	lock_memory_hotplug();
+	old = kswapd_threads;
+	kswapd_threads = threads;
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		ret = kswapd_run(nid);
+		if (ret)
+			break;
 	}
+	if (ret) {
+		/* stop the threads started for the new value */
+		kswapd_threads = old;
+		for_each_node_state(nid, N_HIGH_MEMORY)
+			kswapd_run(nid);
+	}
+	unlock_memory_hotplug();
+	return ret;
 }
 
 static int __init kswapd_init(void)
@@ -3385,25 +4027,16 @@ int page_evictable(struct page *page, struct vm_area_struct *vma)
  */
 void check_move_unevictable_pages(struct page **pages, int nr_pages)
 {
-	struct lruvec *lruvec;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 	int pgscanned = 0;
 	int pgrescued = 0;
 	int i;
 
 	for (i = 0; i < nr_pages; i++) {
 		struct page *page = pages[i];
-		struct zone *pagezone;
 
 		pgscanned++;
-		pagezone = page_zone(page);
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		lruvec = mem_cgroup_page_lruvec(page, zone);
+		lruvec = relock_page_lruvec_irq(page, lruvec);
 
 		if (!PageLRU(page) || !PageUnevictable(page))
 			continue;
@@ -3419,10 +4052,10 @@ void check_move_unevictable_pages(struct page **pages, int nr_pages)
 		}
 	}
 
-	if (zone) {
+	if (lruvec) {
 		__count_vm_events(UNEVICTABLE_PGRESCUED, pgrescued);
 		__count_vm_events(UNEVICTABLE_PGSCANNED, pgscanned);
-		spin_unlock_irq(&zone->lru_lock);
+		unlock_lruvec_irq(lruvec);
 	}
 }
 #endif /* CONFIG_SHMEM */
@@ -463,6 +463,7 @@ void refresh_cpu_vm_stats(int cpu)
 				p->expire = 3;
 #endif
 			}
+		pcp_autotune(zone, &p->pcp);
 		cond_resched();
 #ifdef CONFIG_NUMA
 		/*
@@ -760,6 +761,7 @@ const char * const vmstat_text[] = {
 	"kswapd_skip_congestion_wait",
 	"pageoutrun",
 	"allocstall",
+	"allocstall_time_us",
 
 	"pgrotated",
 
@@ -770,6 +772,9 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"kcompactd_wake",
+	"kcompactd_pages_moved",
+	"kcompactd_throttled",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -793,6 +798,11 @@ const char * const vmstat_text[] = {
 	"thp_split",
 #endif
 
+#ifdef CONFIG_LRU_GEN
+	"lru_gen_age",
+	"lru_gen_young",
+#endif
+
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
 };
 #endif /* CONFIG_PROC_FS || CONFIG_SYSFS || CONFIG_NUMA */
@@ -829,10 +839,7 @@ static void frag_show_print(struct seq_file *m, pg_data_t *pgdat,
 
 	for (color = 0; color < bins; color++) {
 		seq_printf(m, "- color [%d:%0x]", color, color);
-		cnt = 0;
-		list_for_each(curr, &zone->color_list[color])
-			cnt++;
-		seq_printf(m, "%6d\n", cnt);
+		seq_printf(m, "%6u\n", zone->color_nr[color]);
 	}
 #endif /* !CONFIG_CGROUP_PALLOC */
 
@@ -1044,11 +1051,19 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              batch: %i"
+			   "\n              alloc_rate: %u"
+			   "\n              free_rate:  %u"
+			   "\n              refills: %lu"
+			   "\n              drains:  %lu",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.batch,
+			   pageset->pcp.alloc_rate,
+			   pageset->pcp.free_rate,
+			   pageset->pcp.nr_refill,
+			   pageset->pcp.nr_drain);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
@@ -576,8 +576,9 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 	struct svc_serv		*serv = rqstp->rq_server;
 	struct svc_pool		*pool = rqstp->rq_pool;
 	int			len, i;
-	int			pages;
+	int			pages, needed;
 	struct xdr_buf		*arg;
+	LIST_HEAD(list);
 	DECLARE_WAITQUEUE(wait, current);
 	long			time_left;
 
@@ -596,20 +597,29 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 	/* now allocate needed pages.  If we get a failure, sleep briefly */
 	pages = (serv->sv_max_mesg + PAGE_SIZE) / PAGE_SIZE;
 	BUG_ON(pages >= RPCSVC_MAXPAGES);
-	for (i = 0; i < pages ; i++)
-		while (rqstp->rq_pages[i] == NULL) {
-			struct page *p = alloc_page(GFP_KERNEL);
-			if (!p) {
-				set_current_state(TASK_INTERRUPTIBLE);
-				if (signalled() || kthread_should_stop()) {
-					set_current_state(TASK_RUNNING);
-					return -EINTR;
-				}
-				schedule_timeout(msecs_to_jiffies(500));
+	for (needed = 0, i = 0; i < pages ; i++)
+		if (rqstp->rq_pages[i] == NULL)
+			needed++;
+	while (needed) {
+		if (!alloc_pages_bulk(GFP_KERNEL, needed, &list)) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (signalled() || kthread_should_stop()) {
+				set_current_state(TASK_RUNNING);
+				return -EINTR;
 			}
-			rqstp->rq_pages[i] = p;
+			schedule_timeout(msecs_to_jiffies(500));
+			continue;
 		}
-	rqstp->rq_pages[i++] = NULL; /* this might be seen in nfs_read_actor */
+		for (i = 0; i < pages && !list_empty(&list); i++) {
+			if (rqstp->rq_pages[i])
+				continue;
+			rqstp->rq_pages[i] = list_first_entry(&list,
+							struct page, lru);
+			list_del(&rqstp->rq_pages[i]->lru);
+			needed--;
+		}
+	}
+	rqstp->rq_pages[pages] = NULL; /* this might be seen in nfs_read_actor */
 
 	/* Make arg->head point to first page and arg->pages point to rest */
 	arg = &rqstp->rq_arg;
@@ -0,0 +1,137 @@
+# palloc-stat.py - summarize colored page allocations
+#
+# Licensed under the terms of the GNU GPL License version 2
+#
+# Reads the palloc:palloc_alloc tracepoint and prints, per owner group,
+# the allocation outcome counts, color distribution and latency
+# percentiles.  Also counts color cache builds, flushes and fallbacks.
+#
+# usage: perf script -s palloc-stat.py [owner]
+#
+# owner, if given, is the hex owner key of a single group to report.
+
+import os
+import sys
+
+sys.path.append(os.environ['PERF_EXEC_PATH'] + \
+	'/scripts/python/Perf-Trace-Util/lib/Perf/Trace')
+
+from perf_trace_context import *
+from Core import *
+
+usage = "perf script -s palloc-stat.py [owner]\n";
+
+for_owner = None
+
+if len(sys.argv) > 2:
+	sys.exit(usage)
+
+if len(sys.argv) > 1:
+	try:
+		for_owner = int(sys.argv[1], 16)
+	except ValueError:
+		sys.exit(usage)
+
+results = autodict()
+colors = autodict()
+latencies = {}
+iters = autodict()
+zone_events = autodict()
+
+def trace_begin():
+	print "Press control+C to stop and show the summary"
+
+def trace_end():
+	print_palloc_totals()
+
+def palloc__palloc_alloc(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	pfn, order, color, result, iters_, latency, owner):
+	if for_owner is not None and owner != for_owner:
+		return
+
+	res = symbol_str("palloc__palloc_alloc", "result", result)
+	try:
+		results[owner][res] += 1
+	except TypeError:
+		results[owner][res] = 1
+
+	if color >= 0:
+		try:
+			colors[owner][color] += 1
+		except TypeError:
+			colors[owner][color] = 1
+
+	try:
+		iters[owner] += iters_
+	except TypeError:
+		iters[owner] = iters_
+
+	latencies.setdefault(owner, []).append(latency)
+
+def palloc__palloc_build(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	nid, zid, nr):
+	zone_event("build", nid, zid, nr)
+
+def palloc__palloc_flush(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	nid, zid, nr):
+	zone_event("flush", nid, zid, nr)
+
+def palloc__palloc_fallback(event_name, context, common_cpu,
+	common_secs, common_nsecs, common_pid, common_comm,
+	nid, zid, order, migratetype, strict):
+	zone_event("fallback", nid, zid, 1)
+
+def zone_event(name, nid, zid, nr):
+	try:
+		zone_events[(nid, zid)][name] += nr
+	except TypeError:
+		zone_events[(nid, zid)][name] = nr
+
+def percentile(sorted_vals, pct):
+	if not sorted_vals:
+		return 0
+	idx = int(len(sorted_vals) * pct / 100.0)
+	if idx >= len(sorted_vals):
+		idx = len(sorted_vals) - 1
+	return sorted_vals[idx]
+
+def print_palloc_totals():
+	for owner in sorted(results.keys()):
+		total = sum(results[owner].values())
+		hit = results[owner].get("hit", 0)
+
+		print "\nowner 0x%x: %d allocations, %.1f%% color cache hits, " \
+			"%.1f blocks/alloc\n" % \
+			(owner, total, 100.0 * hit / total,
+			 float(iters[owner]) / total)
+
+		print "%-12s  %10s" % ("result", "count")
+		print "%-12s  %10s" % ("------------", "----------")
+		for res, val in sorted(results[owner].iteritems(),
+				       key = lambda(k, v): (v, k), reverse = True):
+			print "%-12s  %10d" % (res, val)
+
+		lat = sorted(latencies[owner])
+		print "\nlatency (ns): p50 %d  p99 %d  p99.9 %d  max %d" % \
+			(percentile(lat, 50), percentile(lat, 99),
+			 percentile(lat, 99.9), lat[-1])
+
+		if colors[owner]:
+			print "\n%-6s  %10s" % ("color", "count")
+			print "%-6s  %10s" % ("------", "----------")
+			for color in sorted(colors[owner].keys()):
+				print "%-6d  %10d" % (color, colors[owner][color])
+
+	if zone_events:
+		print "\n%-8s  %10s  %10s  %10s" % \
+			("node/zone", "built", "flushed", "fallbacks")
+		print "%-8s  %10s  %10s  %10s" % \
+			("---------", "----------", "----------", "----------")
+		for (nid, zid) in sorted(zone_events.keys()):
+			ev = zone_events[(nid, zid)]
+			print "%4d/%-4d  %10d  %10d  %10d" % \
+				(nid, zid, ev.get("build", 0),
+				 ev.get("flush", 0), ev.get("fallback", 0))
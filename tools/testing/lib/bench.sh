@@ -0,0 +1,27 @@
+# Shell helpers shared by the benchmark runners, sourced with
+# . $(dirname $0)/../lib/bench.sh
+
+# mount_cgroup <subsys> <dir> <file>: mount the <subsys> hierarchy on
+# <dir>, unless <dir>/<file> shows it is already there
+mount_cgroup() {
+	[ -f $2/$3 ] && return 0
+	mkdir -p $2
+	if ! mount -t cgroup -o $1 none $2; then
+		echo "cannot mount the $1 cgroup, please run as root"
+		exit 1
+	fi
+}
+
+# enter_group <dir> <grp>: move this shell to a fresh, empty <grp>
+enter_group() {
+	leave_group $1 $2
+	mkdir $2
+	echo $$ > $2/tasks
+}
+
+# leave_group <dir> <grp>: move this shell back to the root of <dir> and
+# remove <grp>
+leave_group() {
+	echo $$ > $1/tasks
+	rmdir $2 2>/dev/null
+}
@@ -0,0 +1,82 @@
+/*
+ * latency.h:
+ *
+ * Latency sampling for the benchmarks under tools/testing. Every thread
+ * records the time of its operations in its own struct latency, and the
+ * samples of all threads are merged and sorted once the run is over to
+ * print the percentiles.
+ */
+
+#ifndef _TOOLS_TESTING_LATENCY_H
+#define _TOOLS_TESTING_LATENCY_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_SAMPLES	(1 << 20)	/* latency samples kept per thread */
+
+struct latency {
+	unsigned long nr;
+	unsigned long *v;
+};
+
+static inline unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline void latency_init(struct latency *l, unsigned long max)
+{
+	l->nr = 0;
+	l->v = malloc((max + 1) * sizeof(unsigned long));
+	if (!l->v) {
+		perror("malloc");
+		exit(1);
+	}
+}
+
+static inline void latency_add(struct latency *l, unsigned long ns)
+{
+	if (l->nr < MAX_SAMPLES)
+		l->v[l->nr++] = ns;
+}
+
+/* append the samples of one thread to all, sized for every thread */
+static inline void latency_merge(struct latency *all,
+				 const struct latency *l)
+{
+	memcpy(all->v + all->nr, l->v, l->nr * sizeof(unsigned long));
+	all->nr += l->nr;
+}
+
+static inline int latency_cmp(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static inline void latency_sort(struct latency *l)
+{
+	qsort(l->v, l->nr, sizeof(unsigned long), latency_cmp);
+}
+
+/* per_mille percentile of sorted samples, 0 when there are none */
+static inline unsigned long latency_pct(const struct latency *l,
+					int per_mille)
+{
+	unsigned long idx;
+
+	if (!l->nr)
+		return 0;
+	idx = l->nr * per_mille / 1000;
+	return l->v[idx < l->nr ? idx : l->nr - 1];
+}
+
+#endif /* _TOOLS_TESTING_LATENCY_H */
@@ -0,0 +1,306 @@
+/*
+ * palloc-bench:
+ *
+ * Allocation benchmark for PALLOC, the cache/bank coloring page
+ * allocator. Runs one workload on a number of threads, each bound to its
+ * own CPU, for a given time and prints a single result line:
+ *
+ *   fault  - first touch faults on a freshly mapped anonymous region
+ *   churn  - mmap, touch and munmap of small regions
+ *   fork   - fork a child that writes to the parent's memory and exits
+ *   mixed  - populate regions of order 0 to 9, the largest as THP
+ *
+ * Throughput is in pages (fault, mixed) or operations (churn, fork) per
+ * second. Latencies are those of a page fault, a churn cycle, a fork or
+ * a region population. Given the palloc.stat file of the cgroup the
+ * benchmark runs in, the color cache hit rate over the run is reported.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "latency.h"
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+#define CHURN_PAGES	16
+#define FORK_PAGES	64
+#define MAX_ORDER	9
+
+enum { W_FAULT, W_CHURN, W_FORK, W_MIXED, NR_WORKLOADS };
+
+static const char * const workload_names[NR_WORKLOADS] = {
+	"fault", "churn", "fork", "mixed",
+};
+
+struct thread {
+	pthread_t tid;
+	int cpu;
+	unsigned long ops;
+	struct latency lat;
+};
+
+static int workload = W_FAULT;
+static int nr_threads = 1;
+static unsigned long region_pages = 16384;	/* 64MB of 4K pages */
+static int duration = 10;
+static const char *stat_file;
+static long page_size;
+static volatile int stop;
+static struct timespec start_ts;
+
+static void *map(unsigned long len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static void run_fault(struct thread *t)
+{
+	unsigned long len = region_pages * page_size;
+	unsigned long i, t0;
+	char *p;
+
+	while (!stop) {
+		p = map(len);
+		for (i = 0; i < region_pages && !stop; i++) {
+			t0 = now_ns();
+			p[i * page_size] = 1;
+			latency_add(&t->lat, now_ns() - t0);
+			t->ops++;
+		}
+		munmap(p, len);
+	}
+}
+
+static void run_churn(struct thread *t)
+{
+	unsigned long len = CHURN_PAGES * page_size;
+	unsigned long t0;
+	char *p;
+
+	while (!stop) {
+		t0 = now_ns();
+		p = map(len);
+		p[0] = 1;
+		p[len - 1] = 1;
+		munmap(p, len);
+		latency_add(&t->lat, now_ns() - t0);
+		t->ops++;
+	}
+}
+
+static void run_fork(struct thread *t)
+{
+	unsigned long len = FORK_PAGES * page_size;
+	unsigned long i, t0;
+	pid_t pid;
+	char *p;
+
+	p = map(len);
+	memset(p, 1, len);
+	while (!stop) {
+		t0 = now_ns();
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (!pid) {
+			/* copy on write faults */
+			for (i = 0; i < FORK_PAGES; i++)
+				p[i * page_size] = 2;
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+		latency_add(&t->lat, now_ns() - t0);
+		t->ops++;
+	}
+	munmap(p, len);
+}
+
+static void run_mixed(struct thread *t)
+{
+	unsigned long huge = (1UL << MAX_ORDER) * page_size;
+	unsigned int seed = t->cpu;
+	unsigned long len, i, t0;
+	int order;
+	char *p, *q;
+
+	while (!stop) {
+		order = rand_r(&seed) % (MAX_ORDER + 1);
+		len = (1UL << order) * page_size;
+		/* align the largest regions so that they can be THP backed */
+		p = map(len + huge);
+		q = (char *)(((unsigned long)p + huge - 1) & ~(huge - 1));
+		if (order == MAX_ORDER)
+			madvise(q, len, MADV_HUGEPAGE);
+		t0 = now_ns();
+		for (i = 0; i < len; i += page_size)
+			q[i] = 1;
+		latency_add(&t->lat, now_ns() - t0);
+		t->ops += 1UL << order;
+		munmap(p, len + huge);
+	}
+}
+
+static void (* const workloads[NR_WORKLOADS])(struct thread *) = {
+	run_fault, run_churn, run_fork, run_mixed,
+};
+
+static void *thread_fn(void *arg)
+{
+	struct thread *t = arg;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+	workloads[workload](t);
+	return NULL;
+}
+
+/* read the hit, miss and fallback counts of a palloc.stat file */
+static int read_stat(unsigned long long *hit, unsigned long long *miss,
+		     unsigned long long *fallback)
+{
+	unsigned long long val;
+	char name[32];
+	FILE *f;
+
+	*hit = *miss = *fallback = 0;
+	if (!stat_file)
+		return -1;
+	f = fopen(stat_file, "r");
+	if (!f) {
+		perror(stat_file);
+		return -1;
+	}
+	while (fscanf(f, "%31s %llu", name, &val) == 2) {
+		if (!strcmp(name, "hit"))
+			*hit = val;
+		else if (!strcmp(name, "miss"))
+			*miss = val;
+		else if (!strcmp(name, "fallback"))
+			*fallback = val;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-w fault|churn|fork|mixed] [-t threads] [-p pages]\n"
+		"       [-d seconds] [-s palloc.stat]\n"
+		"  -t  threads, bound to CPUs 0..threads-1 (default 1)\n"
+		"  -p  pages mapped at a time by the fault workload (16384)\n"
+		"  -d  run time in seconds (10)\n"
+		"  -s  palloc.stat of the cgroup to report the hit rate of\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long hit0, miss0, fb0, hit1, miss1, fb1, acc;
+	unsigned long ops = 0, n = 0, secs_ms, i;
+	struct thread *threads;
+	struct latency all;
+	int c, have_stat;
+
+	while ((c = getopt(argc, argv, "w:t:p:d:s:")) != -1) {
+		switch (c) {
+		case 'w':
+			for (workload = 0; workload < NR_WORKLOADS; workload++)
+				if (!strcmp(optarg, workload_names[workload]))
+					break;
+			if (workload == NR_WORKLOADS)
+				usage(argv[0]);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'p':
+			region_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			stat_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_threads < 1 || duration < 1 || !region_pages)
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	have_stat = !read_stat(&hit0, &miss0, &fb0);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	for (i = 0; i < (unsigned long)nr_threads; i++) {
+		threads[i].cpu = i;
+		latency_init(&threads[i].lat, MAX_SAMPLES);
+		if (pthread_create(&threads[i].tid, NULL, thread_fn,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < (unsigned long)nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		n += threads[i].lat.nr;
+	}
+	secs_ms = (now_ns() - (start_ts.tv_sec * 1000000000UL +
+			       start_ts.tv_nsec)) / 1000000;
+	have_stat = have_stat && !read_stat(&hit1, &miss1, &fb1);
+
+	latency_init(&all, n);
+	for (i = 0; i < (unsigned long)nr_threads; i++)
+		latency_merge(&all, &threads[i].lat);
+	latency_sort(&all);
+
+	printf("workload=%s threads=%d ops=%lu ops_per_sec=%lu "
+	       "p50_ns=%lu p99_ns=%lu p999_ns=%lu",
+	       workload_names[workload], nr_threads, ops,
+	       secs_ms ? ops * 1000 / secs_ms : 0,
+	       latency_pct(&all, 500), latency_pct(&all, 990),
+	       latency_pct(&all, 999));
+	if (have_stat) {
+		acc = (hit1 - hit0) + (miss1 - miss0) + (fb1 - fb0);
+		printf(" hit=%llu miss=%llu fallback=%llu hit_pct=%llu",
+		       hit1 - hit0, miss1 - miss0, fb1 - fb0,
+		       acc ? (hit1 - hit0) * 100 / acc : 0);
+	}
+	printf("\n");
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * reclaim-bench:
+ *
+ * Page reclaim benchmark modelled on a memcached server.  An arena of
+ * fixed size items is kept in anonymous memory and a number of threads
+ * issue GET and SET requests for keys drawn from a Zipf distribution, so
+ * that a small set of hot items takes most of the requests.  When the
+ * arena is larger than the memory the benchmark may use, e.g. under a
+ * memory cgroup limit, the reclaim policy decides how many requests hit
+ * pages that have been swapped out.
+ *
+ * The arena is populated first, then requests run for a given time and a
+ * single result line is printed with the request rate, latency
+ * percentiles and the major faults taken during the run.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "latency.h"
+
+#define ZIPF_TABLE	(1 << 16)	/* buckets of the inverse cdf */
+
+struct thread {
+	pthread_t tid;
+	unsigned int seed;
+	unsigned long ops;
+	struct latency lat;
+};
+
+static unsigned long arena_mb = 1024;
+static unsigned long item_size = 1024;
+static unsigned long nr_items;
+static int nr_threads = 4;
+static int duration = 30;
+static int set_pct = 10;
+static double zipf_s = 0.99;
+static char *arena;
+static unsigned long *zipf_cdf;
+static volatile int stop;
+
+/*
+ * Tabulate the inverse of the Zipf cdf over the item ranks: bucket i
+ * holds the first rank whose cdf reaches i / ZIPF_TABLE.
+ */
+static void zipf_init(void)
+{
+	double norm = 0, sum = 0;
+	unsigned long rank, i = 0;
+
+	zipf_cdf = malloc(ZIPF_TABLE * sizeof(unsigned long));
+	if (!zipf_cdf) {
+		perror("malloc");
+		exit(1);
+	}
+	for (rank = 1; rank <= nr_items; rank++)
+		norm += 1.0 / pow(rank, zipf_s);
+	for (rank = 1; rank <= nr_items && i < ZIPF_TABLE; rank++) {
+		sum += 1.0 / pow(rank, zipf_s) / norm;
+		while (i < ZIPF_TABLE && sum * ZIPF_TABLE >= i)
+			zipf_cdf[i++] = rank - 1;
+	}
+	while (i < ZIPF_TABLE)
+		zipf_cdf[i++] = nr_items - 1;
+}
+
+/*
+ * Pick a key, spread the ranks of one bucket evenly over the items between
+ * it and the next so that the cold tail is not all on a few pages, then
+ * scatter ranks over the arena.
+ */
+static unsigned long zipf_key(struct thread *t)
+{
+	unsigned long b = rand_r(&t->seed) % ZIPF_TABLE;
+	unsigned long lo = zipf_cdf[b];
+	unsigned long hi = b + 1 < ZIPF_TABLE ? zipf_cdf[b + 1] : nr_items;
+	unsigned long rank = lo;
+
+	if (hi > lo + 1)
+		rank += rand_r(&t->seed) % (hi - lo);
+	return (rank * 2654435761UL) % nr_items;
+}
+
+static void *thread_fn(void *arg)
+{
+	struct thread *t = arg;
+	unsigned long key, t0, sum = 0;
+	char *item, buf[64];
+
+	while (!stop) {
+		key = zipf_key(t);
+		item = arena + key * item_size;
+		t0 = now_ns();
+		if ((unsigned long)(rand_r(&t->seed) % 100) < (unsigned long)set_pct) {
+			memset(item, (int)t->ops, item_size);
+		} else {
+			memcpy(buf, item, sizeof(buf));
+			sum += buf[0] + item[item_size - 1];
+		}
+		latency_add(&t->lat, now_ns() - t0);
+		t->ops++;
+	}
+	/* keep the reads from being optimized out */
+	if (sum == 1)
+		fprintf(stderr, "\n");
+	return NULL;
+}
+
+static long majflt(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_majflt;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-m arena MB] [-i item bytes] [-t threads]\n"
+		"       [-d seconds] [-w set percent] [-z zipf exponent]\n"
+		"  -m  size of the item arena (default 1024)\n"
+		"  -i  item size (1024)\n"
+		"  -t  request threads (4)\n"
+		"  -d  run time in seconds after populating (30)\n"
+		"  -w  share of SET requests (10)\n"
+		"  -z  skew of the key popularity (0.99)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ops = 0, n = 0, secs_ms, len, i, t0;
+	struct thread *threads;
+	struct latency all;
+	long flt0;
+	int c;
+
+	while ((c = getopt(argc, argv, "m:i:t:d:w:z:")) != -1) {
+		switch (c) {
+		case 'm':
+			arena_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			item_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'w':
+			set_pct = atoi(optarg);
+			break;
+		case 'z':
+			zipf_s = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_threads < 1 || duration < 1 || !arena_mb || item_size < 64 ||
+	    set_pct < 0 || set_pct > 100 || zipf_s <= 0)
+		usage(argv[0]);
+
+	len = arena_mb << 20;
+	nr_items = len / item_size;
+	arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	zipf_init();
+
+	/* populate, like a cache warming up */
+	t0 = now_ns();
+	for (i = 0; i < nr_items; i++)
+		memset(arena + i * item_size, (int)i, item_size);
+	fprintf(stderr, "populated %lu items in %lu ms\n", nr_items,
+		(now_ns() - t0) / 1000000);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	flt0 = majflt();
+	t0 = now_ns();
+	for (i = 0; i < (unsigned long)nr_threads; i++) {
+		threads[i].seed = i + 1;
+		latency_init(&threads[i].lat, MAX_SAMPLES);
+		if (pthread_create(&threads[i].tid, NULL, thread_fn,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < (unsigned long)nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ops += threads[i].ops;
+		n += threads[i].lat.nr;
+	}
+	secs_ms = (now_ns() - t0) / 1000000;
+
+	latency_init(&all, n);
+	for (i = 0; i < (unsigned long)nr_threads; i++)
+		latency_merge(&all, &threads[i].lat);
+	latency_sort(&all);
+
+	printf("arena_mb=%lu items=%lu threads=%d ops=%lu ops_per_sec=%lu "
+	       "p50_ns=%lu p99_ns=%lu p999_ns=%lu majflt=%ld\n",
+	       arena_mb, nr_items, nr_threads, ops,
+	       secs_ms ? ops * 1000 / secs_ms : 0,
+	       latency_pct(&all, 500), latency_pct(&all, 990),
+	       latency_pct(&all, 999), majflt() - flt0);
+	return 0;
+}